@@ -0,0 +1,168 @@
+#include "CountTimeout.hpp"
+
+const int CountTimeout::keys;
+const int CountTimeout::bucket_ms;
+const int CountTimeout::bucket_count;
+const int CountTimeout::max_tracked;
+const uint32_t CountTimeout::decay_at;
+
+CountTimeout::CountTimeout(int fixed_ms) :
+	fixed_ms(fixed_ms) {
+	for (int k = 0; k < keys; k++)
+		slot_of_key[k].store(-1, std::memory_order_relaxed);
+	for (Tracked& t : tracked) {
+		for (std::atomic<uint32_t>& c : t.counts)
+			c.store(0, std::memory_order_relaxed);
+		t.total.store(0, std::memory_order_relaxed);
+		t.timeout_ms.store(fixed_ms, std::memory_order_relaxed);
+	}
+}
+
+void CountTimeout::setAdaptive(const CountTimeoutConfig& cfg) {
+	if (cfg.percentile < 1 || cfg.percentile > 100 || cfg.margin_ms < 0
+		|| cfg.min_ms < 1 || cfg.min_ms > cfg.max_ms || cfg.max_ms > bucket_ms * bucket_count)
+		throw std::invalid_argument("Not valid COUNT timeout settings, max time is "
+			+ std::to_string(bucket_ms * bucket_count) + " ms");
+	config = cfg;
+	adaptive = true;
+}
+
+int CountTimeout::slot(int key) {
+	int s = slot_of_key[key].load(std::memory_order_acquire);
+	if (s >= 0 || used.load(std::memory_order_relaxed) >= max_tracked)
+		return s;
+	s = used.fetch_add(1, std::memory_order_relaxed);
+	slot_of_key[key].store(s, std::memory_order_release);
+	return s;
+}
+
+int CountTimeout::tap(int key, std::chrono::steady_clock::time_point now, bool in_series) {
+	if (!adaptive)
+		return fixed_ms;
+	int s = slot(key);
+	if (s < 0)
+		return fixed_ms;
+	Tracked& t = tracked[s];
+	if (t.has_last) {
+		long ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - t.last_on).count();
+		// near miss: series ended on timeout just before this tap
+		bool near_miss = !in_series && t.timed_out.exchange(false, std::memory_order_relaxed)
+			&& ms > t.timeout_ms.load(std::memory_order_relaxed);
+		if ((in_series || near_miss) && ms >= 0 && ms <= config.max_ms)
+			record(t, ms);
+	}
+	t.last_on = now;
+	t.has_last = true;
+	return t.timeout_ms.load(std::memory_order_relaxed);
+}
+
+void CountTimeout::series_end(int key, bool on_timeout) {
+	// called by timer thread or event processing, key gets histogram on its first tap
+	int s = slot_of_key[key].load(std::memory_order_acquire);
+	if (adaptive && s >= 0)
+		tracked[s].timed_out.store(on_timeout, std::memory_order_relaxed);
+}
+
+void CountTimeout::record(Tracked& t, int interval_ms) {
+	int b = std::min(interval_ms / bucket_ms, bucket_count - 1);
+	t.counts[b].fetch_add(1, std::memory_order_relaxed);
+	if (t.total.fetch_add(1, std::memory_order_relaxed) + 1 >= decay_at) {
+		uint32_t total = 0;
+		for (std::atomic<uint32_t>& c : t.counts) {
+			uint32_t v = c.load(std::memory_order_relaxed) / 2;
+			c.store(v, std::memory_order_relaxed);
+			total += v;
+		}
+		t.total.store(total, std::memory_order_relaxed);
+	}
+	update_timeout(t);
+}
+
+void CountTimeout::update_timeout(Tracked& t) {
+	const uint64_t total = t.total.load(std::memory_order_relaxed);
+	if (total < static_cast<uint64_t>(config.min_samples))
+		return;
+	// upper edge of bucket where percentile of intervals is reached
+	const uint64_t need = (total * config.percentile + 99) / 100;
+	uint64_t sum = 0;
+	int b = 0;
+	for (; b < bucket_count; b++) {
+		sum += t.counts[b].load(std::memory_order_relaxed);
+		if (sum >= need)
+			break;
+	}
+	int ms = (b + 1) * bucket_ms + config.margin_ms;
+	t.timeout_ms.store(std::max(config.min_ms, std::min(config.max_ms, ms)), std::memory_order_relaxed);
+}
+
+int CountTimeout::timeout(int key) const {
+	if (!adaptive || key < 0 || key >= keys)
+		return fixed_ms;
+	int s = slot_of_key[key].load(std::memory_order_acquire);
+	return s < 0 ? fixed_ms : tracked[s].timeout_ms.load(std::memory_order_relaxed);
+}
+
+unsigned long CountTimeout::samples(int key) const {
+	int s = key >= 0 && key < keys ? slot_of_key[key].load(std::memory_order_acquire) : -1;
+	return s < 0 ? 0 : tracked[s].total.load(std::memory_order_relaxed);
+}
+
+bool CountTimeout::save(const std::string& fileName) const {
+	std::ofstream f(fileName);
+	f << "; COUNT timeouts: channel note timeout_ms, then counts of "
+		<< bucket_ms << " ms intervals" << std::endl;
+	for (int k = 0; k < keys; k++) {
+		int s = slot_of_key[k].load(std::memory_order_acquire);
+		if (s < 0)
+			continue;
+		const Tracked& t = tracked[s];
+		f << k / 128 << " " << k % 128 << " " << t.timeout_ms.load(std::memory_order_relaxed);
+		for (const std::atomic<uint32_t>& c : t.counts)
+			f << " " << c.load(std::memory_order_relaxed);
+		f << "\n";
+	}
+	f.close();
+	return !f.fail();
+}
+
+bool CountTimeout::load(const std::string& fileName) {
+	std::ifstream f(fileName);
+	if (!f)
+		return false;
+	std::string line;
+	while (getline(f, line)) {
+		std::istringstream ss(line.substr(0, line.find(';')));
+		int ch, note, ms;
+		if (!(ss >> ch >> note >> ms) || ch < 0 || ch > 15 || note < 0 || note > 127)
+			continue;
+		int s = slot(ch * 128 + note);
+		if (s < 0)
+			break;
+		Tracked& t = tracked[s];
+		uint32_t total = 0, v;
+		for (int b = 0; b < bucket_count && ss >> v; b++) {
+			t.counts[b].store(v, std::memory_order_relaxed);
+			total += v;
+		}
+		t.total.store(total, std::memory_order_relaxed);
+		// file may be edited by hand
+		t.timeout_ms.store(std::max(config.min_ms, std::min(config.max_ms, ms)), std::memory_order_relaxed);
+		if (adaptive)
+			update_timeout(t);
+	}
+	return true;
+}
+
+std::string CountTimeout::toString() const {
+	std::ostringstream ss;
+	ss << "COUNT timeout ms";
+	if (!adaptive)
+		return ss.str() + ": " + std::to_string(fixed_ms);
+	for (int k = 0; k < keys; k++) {
+		int s = slot_of_key[k].load(std::memory_order_acquire);
+		if (s >= 0)
+			ss << " n," << k / 128 << "," << k % 128 << ": " << tracked[s].timeout_ms.load(std::memory_order_relaxed)
+			<< " (" << tracked[s].total.load(std::memory_order_relaxed) << " taps)";
+	}
+	return ss.str();
+}
@@ -0,0 +1,84 @@
+#ifndef COUNTTIMEOUT_H
+#define COUNTTIMEOUT_H
+
+#include "pch.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// How the COUNT timeout is learned, times in milliseconds
+struct CountTimeoutConfig {
+	int percentile = 95; // of intervals between taps of one key
+	int margin_ms = 50;
+	int min_ms = 200;
+	int max_ms = 1000; // longer intervals are not taps of one series
+	int min_samples = 20; // fixed timeout is used until there are enough taps
+};
+
+// Timeout of COUNT series for every key (channel, note). When adaptive, it
+// keeps histogram of intervals between note ON of one series of a key and
+// sets timeout to percentile of intervals plus margin, within bounds.
+// First tap of a series that comes soon after the previous series ended on
+// timeout is also recorded: it is a slower tap that missed the window, so
+// the timeout grows back when the player slows down. Series that ended by
+// max count or hold and longer pauses between series are not recorded. Histogram counts are halved when they get large,
+// so timeout follows the player. Taps are recorded by event processing only, timeouts and
+// counts are atomic and may be read and saved by any thread.
+class CountTimeout {
+public:
+	static const int keys = 16 * 128;
+
+	explicit CountTimeout(int fixed_ms);
+
+	void setAdaptive(const CountTimeoutConfig& cfg);
+	bool isAdaptive() const {
+		return adaptive;
+	}
+	const CountTimeoutConfig& getConfig() const {
+		return config;
+	}
+	// records note ON of a key, interval to previous note ON is learned if
+	// both are in one series, or if previous series ended on timeout and it
+	// is longer than timeout but not longer than max_ms. Returns timeout
+	// for the series
+	int tap(int key, std::chrono::steady_clock::time_point now, bool in_series);
+	// series of the key ended, on its timeout or by max count or hold
+	void series_end(int key, bool on_timeout);
+	int timeout(int key) const;
+	// number of intervals in histogram of the key
+	unsigned long samples(int key) const;
+
+	// learned histograms are saved as text, one line per key
+	bool save(const std::string& fileName) const;
+	bool load(const std::string& fileName);
+	std::string toString() const;
+
+private:
+	static const int bucket_ms = 10;
+	static const int bucket_count = 200;
+	static const int max_tracked = 64; // counted keys with own histogram
+	static const uint32_t decay_at = 2000;
+
+	struct Tracked {
+		std::atomic<uint32_t> counts[bucket_count];
+		std::atomic<uint32_t> total;
+		std::atomic<int> timeout_ms;
+		std::chrono::steady_clock::time_point last_on;
+		bool has_last = false;
+		std::atomic<bool> timed_out { false }; // last series ended on timeout
+	};
+
+	const int fixed_ms;
+	CountTimeoutConfig config;
+	bool adaptive = false;
+	// index of histogram of the key, -1 if key has none
+	std::atomic<int16_t> slot_of_key[keys];
+	std::atomic<int> used { 0 };
+	Tracked tracked[max_tracked];
+
+	int slot(int key);
+	void record(Tracked& t, int interval_ms);
+	void update_timeout(Tracked& t);
+};
+
+#endif
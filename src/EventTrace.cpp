@@ -0,0 +1,151 @@
+#include "EventTrace.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+const char magic[8] = { 'M', 'I', 'M', 'A', 'P', 'T', 'R', '1' };
+const char type_codes[] = "ancp";
+
+inline midi_byte_t type_code(MidiEventType t) {
+	const char* p = strchr(type_codes, static_cast<char>(t));
+	return p == nullptr ? 0 : static_cast<midi_byte_t>(p - type_codes);
+}
+}
+
+const int TraceWriter::write_period_ms = 50;
+
+TraceWriter::TraceWriter(const std::string& fileName, size_t ring_size) :
+	ring(ring_size) {
+	fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		throw std::runtime_error("Cannot open trace file: " + fileName);
+	buf.reserve(ring_size * 8);
+	buf.insert(buf.end(), magic, magic + sizeof(magic));
+	worker = std::thread(&TraceWriter::run, this);
+}
+
+TraceWriter::~TraceWriter() {
+	close();
+}
+
+bool TraceWriter::record(const MidiEvent& ev, std::chrono::steady_clock::time_point arrival) {
+	long long us = first ? 0 : std::chrono::duration_cast<std::chrono::microseconds>(arrival - prev).count();
+	Record r;
+	r.delta_us = static_cast<uint32_t>(std::min<long long>(std::max<long long>(us, 0), UINT32_MAX));
+	r.type_ch = type_code(ev.evtype) << 4 | (ev.ch & 0x0F);
+	r.v1 = ev.v1;
+	r.v2 = ev.v2;
+	if (!ring.push(r)) {
+		// time of lost event goes to the next one
+		n_dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	prev = arrival;
+	first = false;
+	return true;
+}
+
+void TraceWriter::close() {
+	std::lock_guard<std::mutex> lock(close_mutex);
+	if (fd < 0)
+		return;
+	stopping.store(true);
+	if (worker.joinable())
+		worker.join();
+	::close(fd);
+	fd = -1;
+}
+
+void TraceWriter::run() {
+	while (!stopping.load()) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(write_period_ms));
+		drain();
+	}
+	drain();
+}
+
+void TraceWriter::drain() {
+	Record r;
+	unsigned long n = 0;
+	while (ring.pop(r)) {
+		uint32_t v = r.delta_us;
+		while (v >= 0x80) {
+			buf.push_back(static_cast<uint8_t>(v | 0x80));
+			v >>= 7;
+		}
+		buf.push_back(static_cast<uint8_t>(v));
+		buf.push_back(r.type_ch);
+		buf.push_back(r.v1);
+		buf.push_back(r.v2);
+		n++;
+	}
+	size_t done = 0;
+	while (done < buf.size()) {
+		ssize_t k = write(fd, buf.data() + done, buf.size() - done);
+		if (k < 0 && errno == EINTR)
+			continue;
+		if (k <= 0) {
+			LOG(LogLvl::ERROR) << "Failed to write trace file, lost bytes: " << buf.size() - done;
+			break;
+		}
+		done += k;
+	}
+	buf.clear();
+	n_written.fetch_add(n, std::memory_order_relaxed);
+}
+
+TraceReader::TraceReader(const std::string& fileName) {
+	int fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		throw std::runtime_error("Cannot open trace file: " + fileName);
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(sizeof(magic))) {
+		::close(fd);
+		throw MidiAppError("Not a trace file: " + fileName, true);
+	}
+	size = st.st_size;
+	void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED)
+		throw std::runtime_error("Cannot map trace file: " + fileName);
+	data = static_cast<const uint8_t*>(p);
+	madvise(p, size, MADV_SEQUENTIAL);
+	if (memcmp(data, magic, sizeof(magic)) != 0) {
+		munmap(p, size);
+		throw MidiAppError("Not a trace file: " + fileName, true);
+	}
+	rewind();
+}
+
+TraceReader::~TraceReader() {
+	munmap(const_cast<uint8_t*>(data), size);
+}
+
+void TraceReader::rewind() {
+	pos = sizeof(magic);
+}
+
+bool TraceReader::next(MidiEvent& ev, uint64_t& delta_us) {
+	uint64_t v = 0;
+	for (int shift = 0; ; shift += 7) {
+		if (pos >= size || shift > 63)
+			return false;
+		uint8_t b = data[pos++];
+		v |= static_cast<uint64_t>(b & 0x7F) << shift;
+		if ((b & 0x80) == 0)
+			break;
+	}
+	if (pos + 3 > size)
+		return false; // last event is cut
+	const midi_byte_t type_ch = data[pos];
+	ev.evtype = static_cast<MidiEventType>(type_codes[(type_ch >> 4) & 0x03]);
+	ev.ch = type_ch & 0x0F;
+	ev.v1 = data[pos + 1];
+	ev.v2 = data[pos + 2];
+	pos += 3;
+	delta_us = v;
+	return true;
+}
@@ -0,0 +1,71 @@
+#ifndef EVENTTRACE_H
+#define EVENTTRACE_H
+
+#include "pch.hpp"
+#include "MidiEvent.hpp"
+#include "lib/spsc_ring.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+// Binary trace of input events. File starts with magic bytes, each event is
+// time since previous event in microseconds as unsigned LEB128 varint, then
+// byte with type (high 4 bits) and channel (low 4 bits), then v1 and v2.
+
+// Records events of one thread. Events go to a lock free ring, a writer
+// thread encodes them and writes to file in large blocks.
+class TraceWriter {
+public:
+	explicit TraceWriter(const std::string& fileName, size_t ring_size = 65536);
+	virtual ~TraceWriter();
+
+	// returns false if writer is behind and event is lost
+	bool record(const MidiEvent& ev, std::chrono::steady_clock::time_point arrival);
+	// writes events recorded so far and closes file, later events are lost
+	void close();
+	unsigned long dropped() const {
+		return n_dropped.load(std::memory_order_relaxed);
+	}
+	unsigned long written() const {
+		return n_written.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct Record {
+		uint32_t delta_us;
+		midi_byte_t type_ch, v1, v2;
+	};
+	static const int write_period_ms;
+
+	SpscRing<Record> ring;
+	std::chrono::steady_clock::time_point prev;
+	bool first = true;
+	int fd = -1;
+	std::vector<uint8_t> buf;
+	std::atomic<bool> stopping { false };
+	std::atomic<unsigned long> n_dropped { 0 }, n_written { 0 };
+	std::mutex close_mutex;
+	std::thread worker;
+
+	void run();
+	void drain();
+};
+
+// Reads trace file mapped to memory.
+class TraceReader {
+public:
+	explicit TraceReader(const std::string& fileName);
+	virtual ~TraceReader();
+
+	// next event and its time after previous event, false at the end of file
+	bool next(MidiEvent& ev, uint64_t& delta_us);
+	void rewind();
+
+private:
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+	size_t pos = 0;
+};
+
+#endif
@@ -0,0 +1,15 @@
+#include "GeneratedRules.hpp"
+
+namespace {
+// constant initialized, so it is ready before generated code registers
+const GeneratedRules* linked_rules = nullptr;
+}
+
+const GeneratedRules* generated_rules() {
+	return linked_rules;
+}
+
+bool register_generated_rules(const GeneratedRules* rules) {
+	linked_rules = rules;
+	return true;
+}
@@ -0,0 +1,32 @@
+#ifndef GENERATEDRULES_H
+#define GENERATEDRULES_H
+
+#include "pch.hpp"
+#include "MidiEvent.hpp"
+#include "RuleTable.hpp"
+#include <cstdint>
+
+// Rules compiled to C++ code by rulegen (make app RULES=<file>). Code of
+// PASS and STOP rules is generated, event that reaches COUNT or ONCE rule
+// is left to the interpreter. Generated code is used only for rule file
+// with the same text hash, so edited rule file falls back to rule table.
+struct GeneratedRules {
+	const char* file_name;
+	uint64_t text_hash;
+	size_t rule_count;
+	// same as RuleTable::lookup(), event is changed for SEND only
+	RuleTable::Outcome (*apply)(MidiEvent& ev);
+};
+
+// rules linked into program, nullptr if there are none
+const GeneratedRules* generated_rules();
+// called by generated code on program start
+bool register_generated_rules(const GeneratedRules* rules);
+
+// range check of generated code, bounds are constants
+template<int lower, int upper>
+inline bool in_range(midi_byte_t v) {
+	return lower <= v && v <= upper;
+}
+
+#endif
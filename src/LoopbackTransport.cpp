@@ -0,0 +1,151 @@
+#include "LoopbackTransport.hpp"
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+LoopbackTransport::LoopbackTransport(size_t ring_size) :
+	in_ring(ring_size), out_ring(ring_size), direct_ring(ring_size)
+{
+	pending.reserve(ring_size);
+}
+
+LoopbackTransport::~LoopbackTransport()
+{
+	if (efd >= 0)
+		close(efd);
+}
+
+bool LoopbackTransport::inject(const snd_seq_event_t& event, std::chrono::steady_clock::time_point arrival)
+{
+	// time stamp like ALSA input port with real time stamping
+	snd_seq_event_t ev = event;
+	long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(arrival - epoch).count();
+	ev.flags = (ev.flags & ~SND_SEQ_TIME_STAMP_MASK) | SND_SEQ_TIME_STAMP_REAL;
+	ev.time.time.tv_sec = ns / 1000000000;
+	ev.time.time.tv_nsec = ns % 1000000000;
+	if (!in_ring.push(ev))
+		return false;
+	int fd = efd.load(std::memory_order_acquire);
+	if (fd >= 0) {
+		uint64_t one = 1;
+		if (write(fd, &one, sizeof(one)) < 0) {
+			LOG(LogLvl::WARN) << "Failed to signal loopback input";
+		}
+	}
+	return true;
+}
+
+bool LoopbackTransport::take_output(snd_seq_event_t& event)
+{
+	if (out_ring.pop(event) || direct_ring.pop(event))
+		return true;
+	std::lock_guard<std::mutex> lock(delayed_mutex);
+	if (delayed.empty())
+		return false;
+	event = delayed.front();
+	delayed.pop_front();
+	return true;
+}
+
+int LoopbackTransport::delay_ms(const snd_seq_event_t& event)
+{
+	if (event.queue == SND_SEQ_QUEUE_DIRECT || (event.flags & SND_SEQ_TIME_STAMP_MASK) != SND_SEQ_TIME_STAMP_REAL)
+		return 0;
+	return event.time.time.tv_sec * 1000 + event.time.time.tv_nsec / 1000000;
+}
+
+void LoopbackTransport::send_event(snd_seq_event_t* event) const
+{
+	snd_seq_ev_set_direct(event);
+	snd_seq_ev_set_subs(event);
+	if (!direct_ring.push(*event)) {
+		LOG(LogLvl::WARN) << "Loopback output is full, event lost";
+	}
+	MidiClientStats::add(stats.direct_events);
+}
+
+void LoopbackTransport::queue_event(snd_seq_event_t* event) const
+{
+	snd_seq_ev_set_direct(event);
+	snd_seq_ev_set_subs(event);
+	pending.push_back(*event);
+	MidiClientStats::add(stats.queued_events);
+}
+
+void LoopbackTransport::schedule_event(snd_seq_event_t* event, int delay_ms) const
+{
+	snd_seq_real_time_t delay;
+	delay.tv_sec = delay_ms / 1000;
+	delay.tv_nsec = (delay_ms % 1000) * 1000000;
+	snd_seq_ev_schedule_real(event, 0, 1, &delay);
+	snd_seq_ev_set_subs(event);
+	std::lock_guard<std::mutex> lock(delayed_mutex);
+	delayed.push_back(*event);
+	MidiClientStats::add(stats.delayed_events);
+}
+
+void LoopbackTransport::flush_output() const
+{
+	if (pending.empty())
+		return;
+	for (const snd_seq_event_t& event : pending) {
+		if (!out_ring.push(event)) {
+			LOG(LogLvl::WARN) << "Loopback output is full, event lost";
+		}
+	}
+	pending.clear();
+	MidiClientStats::add(stats.output_flushes);
+}
+
+size_t LoopbackTransport::get_input_batch(std::vector<snd_seq_event_t>& batch) const
+{
+	batch.clear();
+	int fd = efd.load(std::memory_order_acquire);
+	if (fd >= 0) {
+		// clear signal before reading, input injected later signals again
+		uint64_t count;
+		if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+			LOG(LogLvl::WARN) << "Failed to read loopback signal";
+		}
+	}
+	snd_seq_event_t event;
+	unsigned int spins = 0;
+	while (!in_ring.pop(event)) {
+		if (nonblock)
+			return 0;
+		if (++spins > 1000)
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
+	batch.push_back(event);
+	while (in_ring.pop(event))
+		batch.push_back(event);
+	MidiClientStats::add(stats.input_batches);
+	MidiClientStats::add(stats.input_events, batch.size());
+	return batch.size();
+}
+
+std::chrono::steady_clock::time_point LoopbackTransport::arrival_time(const snd_seq_event_t* event) const
+{
+	if ((event->flags & SND_SEQ_TIME_STAMP_MASK) != SND_SEQ_TIME_STAMP_REAL)
+		return std::chrono::steady_clock::now();
+	return epoch + std::chrono::seconds(event->time.time.tv_sec)
+		+ std::chrono::nanoseconds(event->time.time.tv_nsec);
+}
+
+std::vector<pollfd> LoopbackTransport::get_poll_fds() const
+{
+	int fd = efd.load(std::memory_order_acquire);
+	if (fd < 0) {
+		fd = eventfd(in_ring.empty() ? 0 : 1, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fd < 0)
+			throw std::runtime_error("Error creating loopback eventfd");
+		int expected = -1;
+		if (!efd.compare_exchange_strong(expected, fd)) {
+			close(fd);
+			fd = expected;
+		}
+	}
+	pollfd p = {};
+	p.fd = fd;
+	p.events = POLLIN;
+	return std::vector<pollfd>(1, p);
+}
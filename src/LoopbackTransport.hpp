@@ -0,0 +1,55 @@
+#ifndef LOOPBACKTRANSPORT_H
+#define LOOPBACKTRANSPORT_H
+#include "pch.hpp"
+#include "MidiTransport.hpp"
+#include "lib/spsc_ring.hpp"
+#include <atomic>
+#include <deque>
+#include <mutex>
+
+
+// In memory transport for tests and benchmarks, needs no MIDI devices.
+// Input is injected by one thread and read by converter, output is taken by
+// one thread. Queued output comes from one thread and direct output from
+// one other thread (count timer), each of them has own lock free ring.
+// Delayed output is not held back, it keeps its relative time stamp.
+class LoopbackTransport : public MidiTransport
+{
+public:
+	explicit LoopbackTransport(size_t ring_size = 4096);
+	virtual ~LoopbackTransport();
+
+	// input side, returns false if input ring is full, event gets arrival time
+	bool inject(const snd_seq_event_t& event,
+		std::chrono::steady_clock::time_point arrival = std::chrono::steady_clock::now());
+	// output side, queued output first, returns false if there is no output
+	bool take_output(snd_seq_event_t& event);
+	// delay of scheduled output event, 0 if it is sent at once
+	static int delay_ms(const snd_seq_event_t& event);
+
+	void send_event(snd_seq_event_t* event) const override;
+	void queue_event(snd_seq_event_t* event) const override;
+	void flush_output() const override;
+	void schedule_event(snd_seq_event_t* event, int delay_ms) const override;
+	size_t get_input_batch(std::vector<snd_seq_event_t>& batch) const override;
+	std::chrono::steady_clock::time_point arrival_time(const snd_seq_event_t* event) const override;
+	// eventfd that is readable after inject(), created on the first call
+	std::vector<pollfd> get_poll_fds() const override;
+	void set_nonblock(bool nb) const override {
+		nonblock = nb;
+	}
+
+private:
+	const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+	mutable SpscRing<snd_seq_event_t> in_ring;
+	mutable SpscRing<snd_seq_event_t> out_ring;
+	mutable SpscRing<snd_seq_event_t> direct_ring;
+	mutable std::vector<snd_seq_event_t> pending; // queued, not flushed output
+	// delayed output may come from any thread
+	mutable std::mutex delayed_mutex;
+	mutable std::deque<snd_seq_event_t> delayed;
+	mutable std::atomic<int> efd { -1 };
+	mutable bool nonblock = false;
+};
+
+#endif
@@ -81,11 +81,27 @@ void MidiClient::open_alsa_connections(const char* clientName, const char* srcNa
 	snd_seq_set_client_name(seq_handle, clName.c_str());
 	client = snd_seq_client_id(seq_handle);
 
-	inport = snd_seq_create_simple_port(seq_handle, inPortName.c_str(),
-		SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
-		SND_SEQ_PORT_TYPE_APPLICATION);
-	if (inport < 0)
+	// input events get arrival time of the queue in real time units
+	queue = snd_seq_alloc_named_queue(seq_handle, clName.c_str());
+	if (queue < 0)
+		throw std::runtime_error("Error creating ALSA queue");
+
+	snd_seq_port_info_t* pinfo;
+	snd_seq_port_info_alloca(&pinfo);
+	snd_seq_port_info_set_name(pinfo, inPortName.c_str());
+	snd_seq_port_info_set_capability(pinfo, SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE);
+	snd_seq_port_info_set_type(pinfo, SND_SEQ_PORT_TYPE_APPLICATION);
+	snd_seq_port_info_set_timestamping(pinfo, 1);
+	snd_seq_port_info_set_timestamp_real(pinfo, 1);
+	snd_seq_port_info_set_timestamp_queue(pinfo, queue);
+	if (snd_seq_create_port(seq_handle, pinfo) < 0)
 		throw std::runtime_error("Error creating virtual IN port");
+	inport = snd_seq_port_info_get_port(pinfo);
+
+	// read clock before start, time stamps added to it are not later than real arrival
+	queue_start = std::chrono::steady_clock::now();
+	if (snd_seq_start_queue(seq_handle, queue, nullptr) < 0 || snd_seq_drain_output(seq_handle) < 0)
+		throw std::runtime_error("Error starting ALSA queue");
 
 	outport = snd_seq_create_simple_port(seq_handle, outPortName.c_str(),
 		SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
@@ -105,14 +121,96 @@ void MidiClient::send_event(snd_seq_event_t* event) const
 	snd_seq_ev_set_direct(event);
 	snd_seq_ev_set_subs(event);
 	snd_seq_ev_set_source(event, outport);
+	std::lock_guard<std::mutex> lock(out_mutex);
 	snd_seq_event_output_direct(seq_handle, event);
+	MidiClientStats::add(stats.direct_events);
+}
+
+void MidiClient::queue_event(snd_seq_event_t* event) const
+{
+	snd_seq_ev_set_direct(event);
+	snd_seq_ev_set_subs(event);
+	snd_seq_ev_set_source(event, outport);
+	std::lock_guard<std::mutex> lock(out_mutex);
+	if (snd_seq_event_output(seq_handle, event) < 0) {
+		LOG(LogLvl::WARN) << "Failed to queue output MIDI event";
+	}
+	MidiClientStats::add(stats.queued_events);
+	queued++;
+}
+
+void MidiClient::schedule_event(snd_seq_event_t* event, int delay_ms) const
+{
+	snd_seq_real_time_t delay;
+	delay.tv_sec = delay_ms / 1000;
+	delay.tv_nsec = (delay_ms % 1000) * 1000000;
+	snd_seq_ev_schedule_real(event, queue, 1, &delay);
+	snd_seq_ev_set_subs(event);
+	snd_seq_ev_set_source(event, outport);
+	std::lock_guard<std::mutex> lock(out_mutex);
+	if (snd_seq_event_output_direct(seq_handle, event) < 0) {
+		LOG(LogLvl::WARN) << "Failed to schedule output MIDI event";
+	}
+	MidiClientStats::add(stats.delayed_events);
+}
+
+void MidiClient::flush_output() const
+{
+	std::lock_guard<std::mutex> lock(out_mutex);
+	if (queued == 0)
+		return;
+	if (snd_seq_drain_output(seq_handle) < 0) {
+		LOG(LogLvl::WARN) << "Failed to send output MIDI events";
+	}
+	queued = 0;
+	MidiClientStats::add(stats.output_flushes);
+}
+
+std::chrono::steady_clock::time_point MidiClient::arrival_time(const snd_seq_event_t* event) const {
+	if ((event->flags & SND_SEQ_TIME_STAMP_MASK) != SND_SEQ_TIME_STAMP_REAL)
+		return std::chrono::steady_clock::now();
+	return queue_start + std::chrono::seconds(event->time.time.tv_sec)
+		+ std::chrono::nanoseconds(event->time.time.tv_nsec);
 }
 
 snd_seq_event_t* MidiClient::get_input_event() const {
 	snd_seq_event_t* event = nullptr;
 	int result = snd_seq_event_input(seq_handle, &event);
+	if (result == -EAGAIN) {
+		return nullptr; // non blocking mode and no more input
+	}
 	if (result < 0) {
 		LOG(LogLvl::WARN) << "Possible loss of MIDI event";
 	}
 	return event;
 }
+
+size_t MidiClient::get_input_batch(std::vector<snd_seq_event_t>& batch) const {
+	batch.clear();
+	snd_seq_event_t* event = get_input_event();
+	if (nullptr == event)
+		return 0;
+	batch.push_back(*event);
+	// the rest is already read from kernel into ALSA input buffer
+	while (snd_seq_event_input_pending(seq_handle, 0) > 0) {
+		if (snd_seq_event_input(seq_handle, &event) < 0 || nullptr == event)
+			break;
+		batch.push_back(*event);
+	}
+	MidiClientStats::add(stats.input_batches);
+	MidiClientStats::add(stats.input_events, batch.size());
+	return batch.size();
+}
+
+std::vector<pollfd> MidiClient::get_poll_fds() const {
+	int n = snd_seq_poll_descriptors_count(seq_handle, POLLIN);
+	std::vector<pollfd> fds(n > 0 ? n : 0);
+	if (n > 0)
+		fds.resize(snd_seq_poll_descriptors(seq_handle, fds.data(), n, POLLIN));
+	return fds;
+}
+
+void MidiClient::set_nonblock(bool nonblock) const {
+	if (snd_seq_nonblock(seq_handle, nonblock ? 1 : 0) < 0)
+		throw std::runtime_error("Error setting ALSA non blocking mode");
+}
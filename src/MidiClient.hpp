@@ -1,16 +1,25 @@
 #ifndef MIDICLIENT_H
 #define MIDICLIENT_H
 #include "pch.hpp"
+#include "MidiTransport.hpp"
+#include <chrono>
+#include <mutex>
 
 
-
-class MidiClient
+// transport over ALSA sequencer with virtual IN and OUT ports
+class MidiClient : public MidiTransport
 {
 protected:
 	int client = -1;
 	int inport = -1;
 	int outport = -1;
 	snd_seq_t* seq_handle = nullptr;
+	int queue = -1;
+	std::chrono::steady_clock::time_point queue_start;
+	// output may come from count timer thread, queue also time stamps input
+	// and keeps delayed output
+	mutable std::mutex out_mutex;
+	mutable size_t queued = 0;
 
 public:
 	MidiClient(const char* clientName, const char* srcName, const char* dstName)
@@ -20,8 +29,17 @@ public:
 	virtual ~MidiClient()
 	{
 	}
-	void send_event(snd_seq_event_t* event) const;
+	void send_event(snd_seq_event_t* event) const override;
+	void queue_event(snd_seq_event_t* event) const override;
+	void flush_output() const override;
+	// delayed event waits in ALSA queue, it is sent by kernel timer
+	void schedule_event(snd_seq_event_t* event, int delay_ms) const override;
 	snd_seq_event_t* get_input_event() const;
+	size_t get_input_batch(std::vector<snd_seq_event_t>& batch) const override;
+	// kernel time stamp of input event, now if event has no time stamp
+	std::chrono::steady_clock::time_point arrival_time(const snd_seq_event_t* event) const override;
+	std::vector<pollfd> get_poll_fds() const override;
+	void set_nonblock(bool nonblock) const override;
 
 protected:
 	virtual void open_alsa_connections(const char* clientName, const char* srcName, const char* dstName);
@@ -1,30 +1,338 @@
 
 #include "MidiConverter.hpp"
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
 
 void MidiConverter::process_events() {
     MidiEvent ev;
-    snd_seq_event_t* event;
-    const MidiClient* midi_client = rule_mapper->get_midi_client();
     while (true) {
-        event = midi_client->get_input_event();
-        if (nullptr != event && readMidiEvent(event, ev)) {
-            LOG(LogLvl::DEBUG) << "Got midi msg: " << ev.toString();
-            process_one_event(ev);
+        process_batch(ev);
+    }
+}
+
+size_t MidiConverter::process_batch(MidiEvent& ev) {
+    // all input that is ready goes through rules, then output is sent at once
+    const MidiTransport* midi_client = rule_mapper->get_midi_client();
+    if (midi_client->get_input_batch(batch) == 0)
+        return 0;
+    sent.clear();
+    for (size_t i = 0; i < batch.size(); i++) {
+        TimedEvent te;
+        te.arrival = midi_client->arrival_time(&batch[i]);
+        if (process_input(&batch[i], ev, te.arrival)) {
+            te.in_type = ev.evtype;
+            sent.push_back(te);
         }
-        else {
-            LOG(LogLvl::WARN) << "Unknown MIDI event";
+    }
+    midi_client->flush_output();
+    record_latency();
+
+    const MidiClientStats& stats = midi_client->get_stats();
+    unsigned long batches = stats.input_batches.load(std::memory_order_relaxed);
+    if (batches >= next_report) {
+        next_report = batches + report_batches;
+        LOG(LogLvl::INFO) << "MIDI client " << stats.toString();
+    }
+    return batch.size();
+}
+
+bool MidiConverter::process_input(const snd_seq_event_t* event, MidiEvent& ev,
+    std::chrono::steady_clock::time_point arrival) {
+    if (nullptr == event || !readMidiEvent(event, ev)) {
+        LOG(LogLvl::WARN) << "Unknown MIDI event";
+        return false;
+    }
+    if (recorder)
+        recorder->record(ev, arrival);
+    LOG(LogLvl::DEBUG) << "Got midi msg: " << ev.toString();
+    MidiEventType in_type = ev.evtype;
+    bool sent_it = process_one_event(ev, true);
+    ev.evtype = in_type;
+    return sent_it;
+}
+
+void MidiConverter::record_latency() {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    for (const TimedEvent& te : sent) {
+        // arrival from time stamp of input may be a bit later than now
+        long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - te.arrival).count();
+        latency.forType(te.in_type).record(ns > 0 ? ns : 0);
+    }
+    sent.clear();
+}
+
+std::string LatencyStats::toString() const {
+    std::ostringstream ss;
+    ss << "latency note {" << note.toString() << "}\n"
+        << "latency cc {" << cc.toString() << "}\n"
+        << "latency pc {" << pc.toString() << "}";
+    return ss.str();
+}
+
+namespace {
+// set timerfd to the next COUNT deadline, steady_clock is CLOCK_MONOTONIC on linux
+void arm_timerfd(int tfd, const TimerWheel& timer, TimerWheel::clock_t::time_point& armed_at) {
+    TimerWheel::clock_t::time_point t;
+    if (!timer.nextDeadline(t))
+        t = TimerWheel::clock_t::time_point();
+    if (t == armed_at)
+        return;
+    armed_at = t;
+    itimerspec its = {};
+    if (t != TimerWheel::clock_t::time_point()) {
+        long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+        its.it_value.tv_sec = ns / 1000000000;
+        its.it_value.tv_nsec = ns % 1000000000;
+        if (ns <= 0)
+            its.it_value.tv_nsec = 1;
+    }
+    if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, nullptr) < 0)
+        throw std::runtime_error("Error setting timerfd");
+}
+}
+
+void MidiConverter::process_events_reactor() {
+    const MidiTransport* midi_client = rule_mapper->get_midi_client();
+    TimerWheel& timer = rule_mapper->get_count_timer();
+    // only this thread uses the wheel, it takes no lock
+    timer.setThreaded(false);
+    midi_client->set_nonblock(true);
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epfd < 0 || tfd < 0)
+        throw std::runtime_error("Error creating epoll or timerfd");
+    epoll_event eev = {};
+    eev.events = EPOLLIN;
+    eev.data.fd = tfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &eev) < 0)
+        throw std::runtime_error("Error adding timerfd to epoll");
+    for (const pollfd& p : midi_client->get_poll_fds()) {
+        eev.data.fd = p.fd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, p.fd, &eev) < 0)
+            throw std::runtime_error("Error adding ALSA descriptor to epoll");
+    }
+    LOG(LogLvl::INFO) << "Event loop started with epoll";
+
+    MidiEvent ev;
+    epoll_event ready[8];
+    TimerWheel::clock_t::time_point armed_at;
+    while (true) {
+        arm_timerfd(tfd, timer, armed_at);
+        int n = epoll_wait(epfd, ready, 8, -1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            throw std::runtime_error("Error waiting in epoll");
+        for (int i = 0; i < n; i++) {
+            if (ready[i].data.fd == tfd) {
+                uint64_t expirations;
+                if (read(tfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+                    LOG(LogLvl::WARN) << "Error reading timerfd";
+                }
+                armed_at = TimerWheel::clock_t::time_point();
+                timer.advance(timer.getClock().now());
+                continue;
+            }
+            while (process_batch(ev) > 0) {
+            }
         }
     }
 }
 
 
+bool MidiConverter::process_one_event(MidiEvent& ev, bool queued) {
+    if (!rule_mapper->applyRules(ev))
+        return false;
+    LOG(LogLvl::INFO) << "Send mapped event: " << ev.toString();
+    rule_mapper->make_and_send(ev, queued);
+    return true;
+}
+
+namespace {
+typedef std::chrono::steady_clock stage_clock;
+
+inline unsigned long ns_since(stage_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(stage_clock::now() - start).count();
+}
+
+// spin first, then give CPU away while ring stays empty
+inline void idle_wait(unsigned int& spins) {
+    if (++spins < 1000)
+        return;
+    if (spins < 2000)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+}
+
+std::string StageStats::toString() const {
+    unsigned long n = events.load(std::memory_order_relaxed);
+    std::ostringstream ss;
+    ss << "events: " << n << ", avg ns: " << (n == 0 ? 0 : busy_ns.load(std::memory_order_relaxed) / n)
+        << ", max ns: " << max_ns.load(std::memory_order_relaxed);
+    return ss.str();
+}
+
+std::string Pipeline::toString() const {
+    std::ostringstream ss;
+    ss << "reader {" << reader.toString() << ", dropped: " << dropped.load(std::memory_order_relaxed) << "}"
+        << " in_ring {size: " << in_ring.size() << ", max: " << in_ring.max_size() << "}"
+        << " mapper {" << mapper.toString() << "}"
+        << " out_ring {size: " << out_ring.size() << ", max: " << out_ring.max_size() << "}"
+        << " writer {" << writer.toString() << "}";
+    return ss.str();
+}
 
+void MidiConverter::process_events_pipelined(const std::vector<int>& cpus) {
+    pipeline.reset(new Pipeline());
+    std::thread stages[3] = { std::thread(&MidiConverter::run_reader, this),
+        std::thread(&MidiConverter::run_mapper, this), std::thread(&MidiConverter::run_writer, this) };
+    for (size_t i = 0; i < cpus.size() && i < 3; i++)
+        pin_thread(stages[i], cpus[i]);
+    LOG(LogLvl::INFO) << "Pipeline started, ring size: " << Pipeline::ring_size;
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(10));
+        LOG(LogLvl::INFO) << "Pipeline " << pipeline->toString();
+    }
+}
+
+void MidiConverter::run_reader() {
+    // decode input, never waits for other stages
+    const MidiTransport* midi_client = rule_mapper->get_midi_client();
+    std::vector<snd_seq_event_t> input;
+    TimedEvent te;
+    while (true) {
+        if (midi_client->get_input_batch(input) == 0)
+            continue;
+        stage_clock::time_point start = stage_clock::now();
+        for (size_t i = 0; i < input.size(); i++) {
+            if (!readMidiEvent(&input[i], te.ev)) {
+                LOG(LogLvl::WARN) << "Unknown MIDI event";
+                continue;
+            }
+            te.in_type = te.ev.evtype;
+            te.arrival = midi_client->arrival_time(&input[i]);
+            if (recorder)
+                recorder->record(te.ev, te.arrival);
+            if (!pipeline->in_ring.push(te)) {
+                pipeline->dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        pipeline->reader.add(input.size(), ns_since(start));
+    }
+}
 
-void MidiConverter::process_one_event(MidiEvent& ev) {
-    if (rule_mapper->applyRules(ev)) {
-        LOG(LogLvl::INFO) << "Send mapped event: " << ev.toString();
-        rule_mapper->make_and_send(ev);
+void MidiConverter::run_mapper() {
+    TimedEvent te;
+    unsigned int spins = 0;
+    while (true) {
+        if (!pipeline->in_ring.pop(te)) {
+            idle_wait(spins);
+            continue;
+        }
+        spins = 0;
+        stage_clock::time_point start = stage_clock::now();
+        if (rule_mapper->applyRules(te.ev)) {
+            LOG(LogLvl::INFO) << "Send mapped event: " << te.ev.toString();
+            // keep order of output, wait for writer if it is behind
+            while (!pipeline->out_ring.push(te))
+                std::this_thread::yield();
+        }
+        pipeline->mapper.add(1, ns_since(start));
     }
 }
 
+void MidiConverter::run_writer() {
+    const MidiTransport* midi_client = rule_mapper->get_midi_client();
+    TimedEvent te;
+    snd_seq_event_t event;
+    unsigned int spins = 0;
+    while (true) {
+        if (!pipeline->out_ring.pop(te)) {
+            // counted notes of completed series are queued by mapper thread
+            midi_client->flush_output();
+            if (!sent.empty())
+                record_latency();
+            idle_wait(spins);
+            continue;
+        }
+        spins = 0;
+        stage_clock::time_point start = stage_clock::now();
+        snd_seq_ev_clear(&event);
+        if (writeMidiEvent(&event, te.ev)) {
+            midi_client->queue_event(&event);
+            sent.push_back(te);
+        }
+        else {
+            LOG(LogLvl::ERROR) << "Failed to write event: " << te.ev.toString();
+        }
+        pipeline->writer.add(1, ns_since(start));
+    }
+}
+
+void MidiConverter::start_recording(const std::string& fileName) {
+    recorder.reset(new TraceWriter(fileName));
+    LOG(LogLvl::INFO) << "Recording input events to: " << fileName;
+}
+
+void MidiConverter::stop_recording() {
+    if (!recorder)
+        return;
+    recorder->close();
+    LOG(LogLvl::INFO) << "Recorded events: " << recorder->written() << ", lost: " << recorder->dropped();
+}
+
+size_t MidiConverter::replay_trace(const std::string& fileName, bool fast) {
+    TraceReader reader(fileName);
+    const MidiTransport* midi_client = rule_mapper->get_midi_client();
+    TimerWheel& timer = rule_mapper->get_count_timer();
+    if (fast)
+        rule_mapper->setClock(replay_clock);
+    static const size_t fast_batch = 256;
+
+    MidiEvent ev;
+    uint64_t delta_us;
+    size_t n = 0;
+    stage_clock::time_point start = stage_clock::now(), due = start;
+    while (reader.next(ev, delta_us)) {
+        TimedEvent te;
+        if (fast) {
+            replay_clock.advance(std::chrono::microseconds(delta_us));
+            timer.advance(replay_clock.now());
+            te.arrival = stage_clock::now();
+        }
+        else {
+            due += std::chrono::microseconds(delta_us);
+            std::this_thread::sleep_until(due);
+            te.arrival = due;
+        }
+        te.in_type = ev.evtype;
+        if (process_one_event(ev, true))
+            sent.push_back(te);
+        if (!fast || sent.size() >= fast_batch) {
+            midi_client->flush_output();
+            record_latency();
+        }
+        n++;
+    }
+    midi_client->flush_output();
+    record_latency();
+    if (fast) {
+        // counted notes of the last series
+        replay_clock.advance(std::chrono::seconds(10));
+        timer.advance(replay_clock.now());
+    }
+    else {
+        // counted notes of the last series are sent by timer thread
+        for (int i = 0; i < 200 && timer.armedCount() > 0; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    unsigned long ns = ns_since(start);
+    LOG(LogLvl::INFO) << "Replayed events: " << n << " from: " << fileName << ", ns per event: "
+        << (n == 0 ? 0 : ns / n);
+    return n;
+}
@@ -3,14 +3,61 @@
 
 #include "pch.hpp"
 #include "lib/utils.hpp"
-#include "MidiClient.hpp"
+#include "MidiTransport.hpp"
 #include <alsa/asoundlib.h>
 #include "MidiEvent.hpp"
 #include "RuleMapper.hpp"
-#include "MidiClient.hpp"
+#include "MidiTransport.hpp"
 #include "MidiConverter.hpp"
+#include "lib/spsc_ring.hpp"
+#include "lib/histogram.hpp"
+#include "lib/clock.hpp"
+#include "EventTrace.hpp"
+#include <atomic>
+#include <memory>
 
 
+// counters of one stage in pipelined mode, written by the stage thread only
+struct StageStats {
+    std::atomic<unsigned long> events { 0 };
+    std::atomic<unsigned long> busy_ns { 0 };
+    std::atomic<unsigned long> max_ns { 0 };
+
+    void add(unsigned long n, unsigned long ns) {
+        events.store(events.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        busy_ns.store(busy_ns.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+        if (ns > max_ns.load(std::memory_order_relaxed))
+            max_ns.store(ns, std::memory_order_relaxed);
+    }
+    std::string toString() const;
+};
+
+// time from kernel arrival of input event to sending of output, per input type
+struct LatencyStats {
+    LatencyHistogram note, cc, pc;
+
+    LatencyHistogram& forType(MidiEventType t) {
+        return t == MidiEventType::NOTE ? note : (t == MidiEventType::CONTROLCHANGE ? cc : pc);
+    }
+    std::string toString() const;
+};
+
+// event in pipeline rings with arrival time and type of the input event
+struct TimedEvent {
+    MidiEvent ev;
+    MidiEventType in_type = MidiEventType::NOTE;
+    std::chrono::steady_clock::time_point arrival;
+};
+
+// reader -> in_ring -> mapper -> out_ring -> writer
+struct Pipeline {
+    static const size_t ring_size = 4096;
+    SpscRing<TimedEvent> in_ring { ring_size };
+    SpscRing<TimedEvent> out_ring { ring_size };
+    StageStats reader, mapper, writer;
+    std::atomic<unsigned long> dropped { 0 }; // input lost when in_ring is full
+    std::string toString() const;
+};
 
 class MidiConverter {
 private:
@@ -23,7 +70,45 @@ public:
     }
 
     void process_events();
-    void process_one_event(MidiEvent& ev);
+    // one batch of input through rules and output flushed, returns number of
+    // input events, 0 if there is no input in non blocking mode
+    size_t process_batch(MidiEvent& ev);
+    // input, COUNT timers and output on one thread waiting in epoll
+    void process_events_reactor();
+    // returns true if mapped event was sent
+    bool process_one_event(MidiEvent& ev, bool queued = false);
+    // reader, mapper and writer threads connected with lock free rings,
+    // cpus has CPU for each stage or is empty
+    void process_events_pipelined(const std::vector<int>& cpus);
+    // input events are written to binary trace file
+    void start_recording(const std::string& fileName);
+    void stop_recording();
+    // feeds events of trace file to rules with original timing or, if fast,
+    // at once with COUNT timers on virtual time, returns number of events
+    size_t replay_trace(const std::string& fileName, bool fast);
+    const Pipeline* get_pipeline() const {
+        return pipeline.get();
+    }
+    const LatencyStats& get_latency() const {
+        return latency;
+    }
+
+private:
+    std::vector<snd_seq_event_t> batch;
+    unsigned long next_report = report_batches;
+    static const unsigned long report_batches = 10000;
+    std::unique_ptr<Pipeline> pipeline;
+    LatencyStats latency;
+    std::vector<TimedEvent> sent; // output of current batch waiting for flush
+    std::unique_ptr<TraceWriter> recorder;
+    VirtualClock replay_clock;
+
+    bool process_input(const snd_seq_event_t* event, MidiEvent& ev,
+        std::chrono::steady_clock::time_point arrival);
+    void record_latency();
+    void run_reader();
+    void run_mapper();
+    void run_writer();
 
 };
 
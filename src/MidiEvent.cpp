@@ -1,80 +1,151 @@
 
 #include "MidiEvent.hpp"
 #include "lib/utils.hpp"
+#include <cstring>
 
 const midi_byte_t MIDI_MAX = 127;
 const midi_byte_t MIDI_MAXCH = 15;
-template<midi_byte_t max>
-void MidiRange<max>::init(const std::string& s1) {
-	std::string s(s1);
-	remove_spaces(s);
-	if (s.empty()) {
-		lower = 0;
-		upper = max_value;
-		return;
+
+namespace {
+inline bool is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+}
+
+TextSpan TextSpan::code() const {
+	const char* p = static_cast<const char*>(memchr(begin, ';', end - begin));
+	return TextSpan(begin, p == nullptr ? end : p);
+}
+
+bool TextSpan::blank() const {
+	return first() == 0;
+}
+
+size_t TextSpan::count() const {
+	size_t n = 0;
+	for (const char* p = begin; p != end; p++)
+		n += !is_space(*p);
+	return n;
+}
+
+char TextSpan::first() const {
+	for (const char* p = begin; p != end; p++) {
+		if (!is_space(*p))
+			return *p;
+	}
+	return 0;
+}
+
+size_t TextSpan::split(char delimiter, TextSpan* parts, size_t max_parts) const {
+	size_t n = 0;
+	const char* start = begin;
+	for (const char* p = begin; ; p++) {
+		if (p == end || *p == delimiter) {
+			if (n < max_parts)
+				parts[n] = TextSpan(start, p);
+			n++;
+			if (p == end)
+				return n;
+			start = p + 1;
+		}
 	}
+}
 
-	std::vector<std::string> parts = split_string(s, ":");
-	if (parts.size() == 1) {
-		parts.push_back(parts[0]);
+bool TextSpan::toInt(int& v) const {
+	int digits = 0;
+	v = 0;
+	for (const char* p = begin; p != end; p++) {
+		if (is_space(*p))
+			continue;
+		if (*p < '0' || *p > '9')
+			return false;
+		// large values are not valid anyway, keep it from overflow
+		if (v < 100000)
+			v = v * 10 + (*p - '0');
+		digits++;
 	}
-	if (parts.size() != 2) {
-		throw MidiAppError("ValueRange incorrect format: " + s);
+	return digits > 0;
+}
+
+std::string TextSpan::compact() const {
+	std::string s;
+	for (const char* p = begin; p != end; p++) {
+		if (!is_space(*p))
+			s += *p;
 	}
+	return s;
+}
+
+//======================================
 
-	try {
-		lower = stoi(parts[0]);
-		upper = stoi(parts[1]);
+template<midi_byte_t max>
+void MidiRange<max>::init(TextSpan s) {
+	s = s.code();
+	lower = 0;
+	upper = max_value;
+	if (s.blank())
+		return;
+
+	TextSpan parts[2];
+	size_t n = s.split(':', parts, 2);
+	if (n > 2) {
+		throw MidiAppError("ValueRange incorrect format: " + s.compact());
+	}
+	int lo, up;
+	if (!parts[0].toInt(lo) || !parts[n - 1].toInt(up)) {
+		throw MidiAppError("ValueRange incorrect values: " + s.compact());
 	}
-	catch (std::exception& e) {
-		throw MidiAppError("ValueRange incorrect values: " + s);
+	if (lo > max_value || up > max_value) {
+		throw MidiAppError("Not valid values, must be in range: 0-"
+			+ std::to_string(max_value));
 	}
+	lower = lo;
+	upper = up;
 }
 
+template class MidiRange<127>;
+template class MidiRange<15>;
+
 //======================================
 
 const std::string MidiEvent::all_types("ancp");
 const std::string MidiEventRule::all_types("cpsko");
 
-MidiEvent::MidiEvent(const std::string& s1) {
-	std::string s(s1);
-	remove_spaces(s);
-	std::vector<std::string> parts = split_string(s, ",");
-
-	if (parts.size() != 4) {
-		throw MidiAppError("Not valid MidiEvent, must have 4 parts: " + s);
+MidiEvent::MidiEvent(TextSpan s) {
+	s = s.code();
+	TextSpan parts[4];
+	if (s.split(',', parts, 4) != 4) {
+		throw MidiAppError("Not valid MidiEvent, must have 4 parts: " + s.compact());
 	}
 
-	if (parts[0].size() != 1) {
-		throw MidiAppError("MidiEvent, type must be single character: " + s);
+	if (parts[0].count() != 1) {
+		throw MidiAppError("MidiEvent, type must be single character: " + s.compact());
 	}
 
-	try {
-		evtype = static_cast<MidiEventType>(parts[0][0]);
-		ch = stoi(parts[1]);
-		v1 = stoi(parts[2]);
-		v2 = stoi(parts[3]);
-	}
-	catch (std::exception& e) {
-		throw MidiAppError("Not valid MidiEvent: " + std::string(e.what()), true);
+	int c, n1, n2;
+	if (!parts[1].toInt(c) || !parts[2].toInt(n1) || !parts[3].toInt(n2)
+		|| c > MIDI_MAX || n1 > MIDI_MAX || n2 > MIDI_MAX) {
+		throw MidiAppError("Not valid MidiEvent: " + s.compact(), true);
 	}
+	evtype = static_cast<MidiEventType>(parts[0].first());
+	ch = c;
+	v1 = n1;
+	v2 = n2;
 	if (!isValid())
 		throw MidiAppError("Not valid MidiEvent: " + toString(), true);
 }
 
 //========================================================
 
-MidiEventRange::MidiEventRange(const std::string& s1) {
-	std::string s(s1);
-	remove_spaces(s);
-	std::vector<std::string> parts = split_string(s, ",");
-
-	while (parts.size() != 4) {
-		throw MidiAppError("MidiEventRange must have 4 parts: " + s, true);
+MidiEventRange::MidiEventRange(TextSpan s) {
+	s = s.code();
+	TextSpan parts[4];
+	if (s.split(',', parts, 4) != 4) {
+		throw MidiAppError("MidiEventRange must have 4 parts: " + s.compact(), true);
 	}
 
-	if (!parts[0].empty())
-		evtype = static_cast<MidiEventType>(parts[0][0]);
+	evtype = parts[0].blank() ? MidiEventType::ANYTHING
+		: static_cast<MidiEventType>(parts[0].first());
 
 	ch = ChannelRange(parts[1]);
 	v1 = ValueRange(parts[2]);
@@ -117,43 +188,92 @@ void OutMidiEventRange::validate() const {
 
 //===================================================
 
-MidiEventRule::MidiEventRule(const std::string& s1) {
-	std::string s(s1);
-	remove_spaces(s);
-	if (s.empty()) {
+MidiEventRule::MidiEventRule(TextSpan s) {
+	s = s.code();
+	if (s.blank()) {
 		throw MidiAppError("Rule is empty");
 	}
-	std::vector<std::string> parts = split_string(s, "=");
-	if (parts.size() < 2 || parts.size() > 3) {
-		throw MidiAppError("Rule must have 2 or 3 parts: " + s, true);
+	TextSpan parts[3];
+	size_t n = s.split('=', parts, 3);
+	if (n < 2 || n > 3) {
+		throw MidiAppError("Rule must have 2 or 3 parts: " + s.compact(), true);
 	}
-	std::string tmp = parts[parts.size() - 1];
-	if (tmp.size() != 1) {
-		throw MidiAppError("Rule type must be one character: " + s, true);
+	// rule type may have options after it, e.g. c:m3
+	TextSpan type_parts[max_options + 1];
+	size_t n_type = parts[n - 1].split(':', type_parts, max_options + 1);
+	if (type_parts[0].count() != 1) {
+		throw MidiAppError("Rule type must be one character: " + s.compact(), true);
 	}
-	ruleType = static_cast<MidiRuleType>(tmp[0]);
-
-	inEventRange = new InMidiEventRange(parts[0]);
-	if (parts.size() == 3) {
-		outEventRange = new OutMidiEventRange(parts[1]);
+	ruleType = static_cast<MidiRuleType>(type_parts[0].first());
+	maxCount = 0;
+	reserved = 0;
+	holdMs = 0;
+	delayMs = 0;
+	if (n_type > max_options + 1) {
+		throw MidiAppError("Rule has too many options: " + s.compact(), true);
 	}
-	else {
-		outEventRange = nullptr;
+
+	inEventRange = InMidiEventRange(parts[0]);
+	hasOutRange = n == 3;
+	if (hasOutRange) {
+		outEventRange = OutMidiEventRange(parts[1]);
 	}
 	if (!isTypeValid()) {
-		throw MidiAppError("Rule type is unknown: " + s, true);
+		throw MidiAppError("Rule type is unknown: " + s.compact(), true);
+	}
+	for (size_t i = 1; i < n_type; i++) {
+		const TextSpan& opt = type_parts[i];
+		const char* p = opt.begin;
+		while (p != opt.end && is_space(*p))
+			p++;
+		int value;
+		if (p == opt.end || !TextSpan(p + 1, opt.end).toInt(value)) {
+			throw MidiAppError("Rule option must be letter and number: " + s.compact(), true);
+		}
+		setOption(*p, value, s);
 	}
 	if (ruleType == MidiRuleType::COUNT) {
-		if (inEventRange->v2.lower >= 10)
+		if (inEventRange.v2.lower >= 10)
 			throw MidiAppError(
-				"Count rule - input value range must be >= 10: " + s, true);
+				"Count rule - input value range must be >= 10: " + s.compact(), true);
+
+	}
+}
 
+void MidiEventRule::setOption(char key, int value, const TextSpan& s) {
+	if (key == 'm' && ruleType == MidiRuleType::COUNT) {
+		if (value < 1 || value > MIDI_MAX)
+			throw MidiAppError("Count rule - max count must be 1-127: " + s.compact(), true);
+		maxCount = value;
+		return;
+	}
+	if (key == 'h' && ruleType == MidiRuleType::COUNT) {
+		if (value < 1 || value > 10000)
+			throw MidiAppError("Count rule - hold time must be 1-10000 ms: " + s.compact(), true);
+		holdMs = value;
+		return;
+	}
+	// PASS and ONCE rules pass event on, it is sent by a later rule
+	if (key == 'd' && (ruleType == MidiRuleType::STOP || ruleType == MidiRuleType::COUNT)) {
+		if (value < 1 || value > 10000)
+			throw MidiAppError("Rule delay must be 1-10000 ms: " + s.compact(), true);
+		delayMs = value;
+		return;
 	}
+	throw MidiAppError("Rule option is unknown: " + std::string(1, key) + " in " + s.compact(), true);
 }
 
 std::string MidiEventRule::toString() const {
 	std::ostringstream ss;
-	ss << inEventRange->toString() << "=" << outEventRange->toString() << "="
-		<< static_cast<char>(ruleType);
+	ss << inEventRange.toString() << "=";
+	if (hasOutRange)
+		ss << outEventRange.toString() << "=";
+	ss << static_cast<char>(ruleType);
+	if (maxCount > 0)
+		ss << ":m" << static_cast<int>(maxCount);
+	if (holdMs > 0)
+		ss << ":h" << holdMs;
+	if (delayMs > 0)
+		ss << ":d" << delayMs;
 	return ss.str();
 }
@@ -2,6 +2,9 @@
 #define MIDIEVENT_H
 
 #include "pch.hpp"
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
 
 
 typedef unsigned char midi_byte_t;
@@ -26,11 +29,44 @@ public:
 		return this->msg.c_str();
 	}
 };
+//=============================================================
+// Part of a text that is not copied, rules are parsed through it without
+// allocations. Spaces inside are skipped and text after ';' is a comment.
+struct TextSpan {
+	const char* begin;
+	const char* end;
+
+	TextSpan() :
+		begin(nullptr), end(nullptr) {
+	}
+	TextSpan(const char* b, const char* e) :
+		begin(b), end(e) {
+	}
+	explicit TextSpan(const std::string& s) :
+		begin(s.data()), end(s.data() + s.size()) {
+	}
+
+	// text before comment
+	TextSpan code() const;
+	// true if there are only spaces
+	bool blank() const;
+	// number of characters that are not spaces
+	size_t count() const;
+	// first character that is not space, 0 if blank
+	char first() const;
+	// parts between delimiters, returns number of parts, only max_parts are stored
+	size_t split(char delimiter, TextSpan* parts, size_t max_parts) const;
+	// decimal number with optional spaces, false if not a number
+	bool toInt(int& v) const;
+	// text without spaces, for error messages
+	std::string compact() const;
+};
+
 //=============================================================
 template<midi_byte_t max>
 class MidiRange {
 protected:
-	void init(const std::string&);
+	void init(TextSpan);
 
 public:
 	static const midi_byte_t max_value = max;
@@ -41,11 +77,11 @@ public:
 		upper = max_value;
 	}
 
-	MidiRange(const std::string& s) {
+	MidiRange(TextSpan s) {
 		init(s);
-		if (!isValid()) {
-			throw MidiAppError(err_msg);
-		}
+	}
+	MidiRange(const std::string& s) {
+		init(TextSpan(s));
 	}
 
 	std::string toString() const {
@@ -67,10 +103,6 @@ public:
 	inline void transform(midi_byte_t& v) const {
 		v = lower == upper ? lower : v;
 	}
-
-private:
-	std::string err_msg = "Not valid values, must be in range: 0-"
-		+ std::to_string(max_value);
 };
 
 using ValueRange = MidiRange<127>;
@@ -86,12 +118,21 @@ enum class MidiEventType : midi_byte_t {
 
 class MidiEvent {
 	const static std::string all_types;
+	// bytes of type, channel and v1 in packed()
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	static const uint32_t no_v2_mask = 0x00FFFFFF;
+#else
+	static const uint32_t no_v2_mask = 0xFFFFFF00;
+#endif
 public:
 	MidiEvent() :
 		evtype(MidiEventType::ANYTHING), ch(0), v1(0), v2(0) {
 	}
 
-	MidiEvent(const std::string&);
+	MidiEvent(TextSpan);
+	MidiEvent(const std::string& s) :
+		MidiEvent(TextSpan(s)) {
+	}
 
 	MidiEventType evtype;
 	midi_byte_t ch; // MIDI channel
@@ -104,11 +145,17 @@ public:
 			<< std::to_string(v1) << "," << std::to_string(v2);
 		return ss.str();
 	}
+	// all four bytes as one word, compared at once
+	inline uint32_t packed() const {
+		uint32_t u;
+		memcpy(&u, this, sizeof(u));
+		return u;
+	}
 	inline bool isEqual(const MidiEvent& ev) const {
-		return evtype == ev.evtype && ch == ev.ch && v1 == ev.v1 && v2 == ev.v2;
+		return packed() == ev.packed();
 	}
 	inline bool isSimilar(const MidiEvent& ev) const {
-		return evtype == ev.evtype && ch == ev.ch && v1 == ev.v1;
+		return ((packed() ^ ev.packed()) & no_v2_mask) == 0;
 	}
 	inline char typeToChar() const {
 		return static_cast<char>(evtype);
@@ -136,11 +183,15 @@ public:
 		return evtype == MidiEventType::PROGCHANGE;
 	}
 };
+static_assert(sizeof(MidiEvent) == 4, "MidiEvent must pack to 32 bits");
 
 
 class MidiEventRange {
 protected:
-	MidiEventRange(const std::string& s);
+	MidiEventRange() :
+		evtype(MidiEventType::ANYTHING) {
+	}
+	MidiEventRange(TextSpan s);
 public:
 	std::string toString() const;
 
@@ -152,14 +203,19 @@ public:
 
 class InMidiEventRange : public MidiEventRange {
 public:
-	InMidiEventRange(const std::string& s) : MidiEventRange(s) { validate(); }
+	InMidiEventRange() {}
+	InMidiEventRange(TextSpan s) : MidiEventRange(s) { validate(); }
+	InMidiEventRange(const std::string& s) : InMidiEventRange(TextSpan(s)) {}
 	bool match(const MidiEvent&) const;
 	void validate() const;
 };
 
 class OutMidiEventRange : public MidiEventRange {
 public:
-	OutMidiEventRange(const std::string& s) : MidiEventRange(s) { validate(); }
+	// without output range event is not changed
+	OutMidiEventRange() {}
+	OutMidiEventRange(TextSpan s) : MidiEventRange(s) { validate(); }
+	OutMidiEventRange(const std::string& s) : OutMidiEventRange(TextSpan(s)) {}
 	void transform(MidiEvent& ev) const;
 	void validate() const;
 };
@@ -170,8 +226,17 @@ enum class MidiRuleType : midi_byte_t {
 
 class MidiEventRule {
 	const static std::string all_types;
+	static const size_t max_options = 3;
+	void setOption(char key, int value, const TextSpan& s);
 public:
-	MidiEventRule(const std::string&);
+	// rule that passes any event, fields are set by rule cache
+	MidiEventRule() :
+		hasOutRange(false), ruleType(MidiRuleType::PASS), maxCount(0), reserved(0), holdMs(0), delayMs(0) {
+	}
+	MidiEventRule(TextSpan);
+	MidiEventRule(const std::string& s) :
+		MidiEventRule(TextSpan(s)) {
+	}
 	std::string toString() const;
 
 	inline char typeToChar() const {
@@ -180,9 +245,18 @@ public:
 	inline bool isTypeValid() const {
 		return MidiEventRule::all_types.find(typeToChar()) != std::string::npos;
 	}
-	InMidiEventRange* inEventRange;
-	OutMidiEventRange* outEventRange;
+	// rule is a plain record of bytes, rules are kept by value in one array
+	InMidiEventRange inEventRange;
+	OutMidiEventRange outEventRange;
+	bool hasOutRange;
 	MidiRuleType ruleType;
+	// options after rule type
+	midi_byte_t maxCount; // c:m3 - count series ends at once on 3-rd note ON, 0 if not set
+	midi_byte_t reserved; // always 0, fills padding so cache image of rules has no stray bytes
+	uint16_t holdMs; // c:h400 - note held 400 ms ends count series at once, 0 if not set
+	uint16_t delayMs; // s:d250 - event sent by STOP or COUNT rule goes out 250 ms later, 0 if not set
 };
+static_assert(sizeof(MidiEventRule) == 22, "MidiEventRule must be 22 bytes without padding");
+static_assert(std::is_trivially_copyable<MidiEventRule>::value, "MidiEventRule must be plain data");
 
 #endif
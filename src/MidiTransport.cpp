@@ -0,0 +1,11 @@
+#include "MidiTransport.hpp"
+
+std::string MidiClientStats::toString() const {
+	std::ostringstream ss;
+	ss << "input events: " << input_events.load(std::memory_order_relaxed) << ", avg batch: " << avg_batch()
+		<< ", output queued: " << queued_events.load(std::memory_order_relaxed)
+		<< ", flushes: " << output_flushes.load(std::memory_order_relaxed)
+		<< ", direct: " << direct_events.load(std::memory_order_relaxed)
+		<< ", delayed: " << delayed_events.load(std::memory_order_relaxed) << ", syscalls saved: " << syscalls_saved();
+	return ss.str();
+}
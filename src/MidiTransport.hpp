@@ -0,0 +1,68 @@
+#ifndef MIDITRANSPORT_H
+#define MIDITRANSPORT_H
+#include "pch.hpp"
+#include <atomic>
+#include <chrono>
+
+
+// counters of batched input and output, direct and delayed output
+// also comes from count timer thread, any thread may read them
+struct MidiClientStats {
+	std::atomic<unsigned long> input_batches { 0 };
+	std::atomic<unsigned long> input_events { 0 };
+	std::atomic<unsigned long> output_flushes { 0 };
+	std::atomic<unsigned long> queued_events { 0 };
+	std::atomic<unsigned long> direct_events { 0 };
+	std::atomic<unsigned long> delayed_events { 0 };
+
+	static void add(std::atomic<unsigned long>& counter, unsigned long n = 1) {
+		counter.fetch_add(n, std::memory_order_relaxed);
+	}
+	double avg_batch() const {
+		unsigned long batches = input_batches.load(std::memory_order_relaxed);
+		return batches == 0 ? 0 : static_cast<double>(input_events.load(std::memory_order_relaxed)) / batches;
+	}
+	// one read per batch and one drain per flush instead of one call per event
+	unsigned long syscalls_saved() const {
+		unsigned long queued = queued_events.load(std::memory_order_relaxed);
+		unsigned long flushes = output_flushes.load(std::memory_order_relaxed);
+		return (input_events.load(std::memory_order_relaxed) - input_batches.load(std::memory_order_relaxed))
+			+ (queued > flushes ? queued - flushes : 0);
+	}
+	std::string toString() const;
+};
+
+// Source and destination of MIDI events used by converter and rules.
+// Events are ALSA sequencer structures, an implementation does not need
+// the sequencer device to pass them.
+class MidiTransport
+{
+protected:
+	mutable MidiClientStats stats;
+
+public:
+	virtual ~MidiTransport()
+	{
+	}
+	// sends event at once
+	virtual void send_event(snd_seq_event_t* event) const = 0;
+	// output is buffered until flush_output()
+	virtual void queue_event(snd_seq_event_t* event) const = 0;
+	virtual void flush_output() const = 0;
+	// sends event delay_ms later, transport keeps it so no thread waits
+	virtual void schedule_event(snd_seq_event_t* event, int delay_ms) const = 0;
+	// waits for input and copies all input events that are ready to batch,
+	// returns batch size, in non blocking mode returns 0 if no input
+	virtual size_t get_input_batch(std::vector<snd_seq_event_t>& batch) const = 0;
+	// time when input event arrived, now if it is not known
+	virtual std::chrono::steady_clock::time_point arrival_time(const snd_seq_event_t* event) const = 0;
+	// descriptors to wait for input events with poll or epoll
+	virtual std::vector<pollfd> get_poll_fds() const = 0;
+	virtual void set_nonblock(bool nonblock) const = 0;
+
+	const MidiClientStats& get_stats() const {
+		return stats;
+	}
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include "RuleCache.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+const char magic[8] = { 'M', 'I', 'M', 'A', 'P', 'R', 'C', '1' };
+
+struct CacheHeader {
+	char magic[8];
+	uint64_t hash;
+	uint32_t rule_size;
+	uint32_t entry_size;
+	uint32_t rule_count;
+	uint32_t table_size; // 0 if there is no table
+};
+
+bool write_all(int fd, const void* p, size_t size) {
+	const char* b = static_cast<const char*>(p);
+	while (size > 0) {
+		ssize_t n = write(fd, b, size);
+		if (n <= 0)
+			return false;
+		b += n;
+		size -= n;
+	}
+	return true;
+}
+}
+
+std::string rule_cache_name(const std::string& ruleFile) {
+	return ruleFile + ".cache";
+}
+
+uint64_t rule_text_hash(const std::string& text) {
+	uint64_t h = 14695981039346656037ULL;
+	for (char c : text) {
+		h ^= static_cast<unsigned char>(c);
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+bool load_rule_cache(const std::string& cacheFile, uint64_t hash, RuleSet& rs) {
+	int fd = open(cacheFile.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(sizeof(CacheHeader))) {
+		::close(fd);
+		return false;
+	}
+	const size_t size = st.st_size;
+	void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED)
+		return false;
+	std::shared_ptr<const void> image(p, [size](const void* q) {
+		munmap(const_cast<void*>(q), size);
+	});
+
+	CacheHeader h;
+	memcpy(&h, p, sizeof(h));
+	if (memcmp(h.magic, magic, sizeof(magic)) != 0 || h.hash != hash
+		|| h.rule_size != sizeof(MidiEventRule) || h.entry_size != RuleTable::entrySize()
+		|| (h.table_size != 0 && h.table_size != RuleTable::dataSize())
+		|| size != sizeof(h) + static_cast<size_t>(h.rule_count) * sizeof(MidiEventRule) + h.table_size)
+		return false;
+
+	// rules are plain records, copied to rule list at once
+	const char* records = static_cast<const char*>(p) + sizeof(h);
+	rs.rules.resize(h.rule_count);
+	memcpy(rs.rules.data(), records, h.rule_count * sizeof(MidiEventRule));
+	if (h.table_size != 0 && rs.engine == RuleEngine::TABLE)
+		rs.table.attach(records + h.rule_count * sizeof(MidiEventRule), h.table_size);
+	rs.image = image;
+	return true;
+}
+
+bool save_rule_cache(const std::string& cacheFile, uint64_t hash, const RuleSet& rs) {
+	CacheHeader h;
+	memcpy(h.magic, magic, sizeof(magic));
+	h.hash = hash;
+	h.rule_size = sizeof(MidiEventRule);
+	h.entry_size = RuleTable::entrySize();
+	h.rule_count = rs.rules.size();
+	h.table_size = rs.table.isBuilt() ? RuleTable::dataSize() : 0;
+
+
+	// converters of several files may write it at the same time
+	std::string tmp = cacheFile + ".XXXXXX";
+	int fd = mkstemp(&tmp[0]);
+	if (fd < 0)
+		return false;
+	fchmod(fd, 0644);
+	bool ok = write_all(fd, &h, sizeof(h))
+		&& write_all(fd, rs.rules.data(), rs.rules.size() * sizeof(MidiEventRule))
+		&& write_all(fd, rs.table.data(), h.table_size);
+	ok = ::close(fd) == 0 && ok;
+	if (!ok || rename(tmp.c_str(), cacheFile.c_str()) != 0) {
+		unlink(tmp.c_str());
+		return false;
+	}
+	return true;
+}
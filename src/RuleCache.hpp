@@ -0,0 +1,22 @@
+#ifndef RULECACHE_H
+#define RULECACHE_H
+
+#include "pch.hpp"
+#include "RuleSet.hpp"
+#include <cstdint>
+
+// Compiled rules are saved next to the rule file as <file>.cache. Image has
+// header with hash of the rule text, rule records and table of TABLE engine.
+// On start image is mapped and used if the hash is the same, rule text is
+// not parsed. Image is for this machine, header keeps record sizes to detect
+// image of another build.
+
+std::string rule_cache_name(const std::string& ruleFile);
+// 64-bit FNV-1a of rule text
+uint64_t rule_text_hash(const std::string& text);
+// fills empty rule set from image, false if there is no image for the hash
+bool load_rule_cache(const std::string& cacheFile, uint64_t hash, RuleSet& rs);
+// writes image of rule set, old image is replaced at once with rename()
+bool save_rule_cache(const std::string& cacheFile, uint64_t hash, const RuleSet& rs);
+
+#endif
@@ -0,0 +1,100 @@
+#include "RuleCodegen.hpp"
+
+namespace {
+const char* type_name(MidiEventType t) {
+	switch (t) {
+	case MidiEventType::NOTE: return "MidiEventType::NOTE";
+	case MidiEventType::CONTROLCHANGE: return "MidiEventType::CONTROLCHANGE";
+	case MidiEventType::PROGCHANGE: return "MidiEventType::PROGCHANGE";
+	default: return "MidiEventType::ANYTHING";
+	}
+}
+
+template<midi_byte_t max>
+void add_check(std::vector<std::string>& checks, const MidiRange<max>& r, const char* field) {
+	std::ostringstream ss;
+	if (r.lower == 0 && r.upper == max)
+		return;
+	if (r.lower == r.upper)
+		ss << "e." << field << " == " << static_cast<int>(r.lower);
+	else
+		ss << "in_range<" << static_cast<int>(r.lower) << ", " << static_cast<int>(r.upper) << ">(e." << field << ")";
+	checks.push_back(ss.str());
+}
+
+std::string match_code(const InMidiEventRange& in) {
+	std::vector<std::string> checks;
+	if (in.evtype != MidiEventType::ANYTHING)
+		checks.push_back(std::string("e.evtype == ") + type_name(in.evtype));
+	add_check(checks, in.ch, "ch");
+	add_check(checks, in.v1, "v1");
+	add_check(checks, in.v2, "v2");
+	if (checks.empty())
+		return "true";
+	std::string s = checks[0];
+	for (size_t i = 1; i < checks.size(); i++)
+		s += " && " + checks[i];
+	return s;
+}
+
+template<midi_byte_t max>
+void add_store(std::ostringstream& ss, const MidiRange<max>& r, const char* field) {
+	if (r.lower == r.upper)
+		ss << "\t\te." << field << " = " << static_cast<int>(r.lower) << ";\n";
+}
+
+std::string transform_code(const MidiEventRule& rule) {
+	std::ostringstream ss;
+	if (!rule.hasOutRange)
+		return "";
+	const OutMidiEventRange& out = rule.outEventRange;
+	if (out.evtype != MidiEventType::ANYTHING)
+		ss << "\t\te.evtype = " << type_name(out.evtype) << ";\n";
+	add_store(ss, out.ch, "ch");
+	add_store(ss, out.v1, "v1");
+	add_store(ss, out.v2, "v2");
+	return ss.str();
+}
+
+std::string c_string(const std::string& s) {
+	std::string out = "\"";
+	for (char c : s) {
+		if (c == '"' || c == '\\')
+			out += '\\';
+		out += c;
+	}
+	return out + "\"";
+}
+}
+
+std::string generate_rule_code(const std::vector<MidiEventRule>& rules,
+	const std::string& fileName, uint64_t textHash) {
+	std::ostringstream ss;
+	ss << "// Generated by rulegen from " << fileName << ", do not edit.\n"
+		"#include \"GeneratedRules.hpp\"\n\n"
+		"namespace {\n"
+		"RuleTable::Outcome apply(MidiEvent& ev) {\n"
+		"\tMidiEvent e = ev;\n";
+	for (size_t i = 0; i < rules.size(); i++) {
+		const MidiEventRule& rule = rules[i];
+		const bool last = i + 1 == rules.size();
+		ss << "\t// #" << i << " " << rule.toString() << "\n"
+			<< "\tif (" << match_code(rule.inEventRange) << ") {\n";
+		if (rule.ruleType == MidiRuleType::COUNT || rule.ruleType == MidiRuleType::ONCE || rule.delayMs > 0) {
+			ss << "\t\treturn RuleTable::Outcome::INTERPRET;\n";
+		}
+		else {
+			ss << transform_code(rule);
+			if (last || rule.ruleType == MidiRuleType::STOP)
+				ss << "\t\tev = e;\n\t\treturn RuleTable::Outcome::SEND;\n";
+		}
+		ss << "\t}\n";
+	}
+	ss << "\treturn RuleTable::Outcome::DROP;\n"
+		"}\n\n"
+		"const GeneratedRules rules = { " << c_string(fileName) << ", " << textHash << "ULL, "
+		<< rules.size() << ", apply };\n"
+		"const bool registered = register_generated_rules(&rules);\n"
+		"}\n";
+	return ss.str();
+}
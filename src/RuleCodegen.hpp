@@ -0,0 +1,14 @@
+#ifndef RULECODEGEN_H
+#define RULECODEGEN_H
+
+#include "pch.hpp"
+#include "MidiEvent.hpp"
+#include <cstdint>
+
+// C++ source with function that applies the rules, see GeneratedRules.hpp.
+// Rules are unrolled in file order: constant ranges become compares, full
+// ranges are left out and transforms are constant stores.
+std::string generate_rule_code(const std::vector<MidiEventRule>& rules,
+	const std::string& fileName, uint64_t textHash);
+
+#endif
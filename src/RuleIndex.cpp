@@ -0,0 +1,30 @@
+#include "RuleIndex.hpp"
+
+void RuleIndex::build(const std::vector<MidiEventRule>& rules) {
+	clear();
+	for (size_t i = 0; i < rules.size(); i++) {
+		const InMidiEventRange& in = rules[i].inEventRange;
+		int t = typeIndex(in.evtype);
+		if (t < 0)
+			continue; // such rule can not match any event
+		for (size_t k = 0; k < type_count; k++) {
+			if (in.evtype != MidiEventType::ANYTHING && k != static_cast<size_t>(t))
+				continue;
+			for (size_t ch = in.ch.lower; ch <= in.ch.upper; ch++)
+				buckets[k * ch_count + ch].push_back(i);
+		}
+	}
+	built = true;
+}
+
+int RuleIndex::findMatchingRule(const std::vector<MidiEventRule>& rules, const MidiEvent& ev, int startPos) const {
+	int t = typeIndex(ev.evtype);
+	if (t < 0 || ev.ch >= ch_count)
+		return -1; // no rule can match such event
+	const std::vector<int>& b = buckets[t * ch_count + ev.ch];
+	for (auto it = std::lower_bound(b.begin(), b.end(), startPos); it != b.end(); ++it) {
+		if (rules[*it].inEventRange.match(ev))
+			return *it;
+	}
+	return -1;
+}
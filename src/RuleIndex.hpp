@@ -0,0 +1,45 @@
+#ifndef RULEINDEX_H
+#define RULEINDEX_H
+
+#include "pch.hpp"
+#include "MidiEvent.hpp"
+
+// For each event type and channel keeps ordered list of rules that may match it.
+// Rules of type ANYTHING are in every type list at their position in the rule file,
+// so scanning one list gives the same first match as scanning all rules.
+class RuleIndex {
+public:
+	void build(const std::vector<MidiEventRule>& rules);
+	void clear() {
+		for (size_t i = 0; i < bucket_count; i++)
+			std::vector<int>().swap(buckets[i]);
+		built = false;
+	}
+	bool isBuilt() const {
+		return built;
+	}
+
+	// returns index of first rule at or after startPos that matches event, -1 if none
+	int findMatchingRule(const std::vector<MidiEventRule>& rules, const MidiEvent& ev, int startPos) const;
+
+private:
+	// types: anything, note, cc, program change
+	static const size_t type_count = 4;
+	static const size_t ch_count = 16;
+	static const size_t bucket_count = type_count * ch_count;
+
+	std::vector<int> buckets[bucket_count];
+	bool built = false;
+
+	static inline int typeIndex(MidiEventType t) {
+		switch (t) {
+		case MidiEventType::ANYTHING: return 0;
+		case MidiEventType::NOTE: return 1;
+		case MidiEventType::CONTROLCHANGE: return 2;
+		case MidiEventType::PROGCHANGE: return 3;
+		default: return -1;
+		}
+	}
+};
+
+#endif
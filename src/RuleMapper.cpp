@@ -3,60 +3,187 @@
 
 
 const int RuleMapper::sleep_ms = 600;
+const int RuleMapper::count_keys;
 
-RuleMapper::RuleMapper(const std::string& fileName, MidiClient* mc) : midi_client(mc)
+namespace {
+// timer key and argument for counted note: delay of rule, count and event
+inline int count_key(const MidiEvent& ev) {
+	return (ev.ch & 0x0F) * 128 + (ev.v1 & 0x7F);
+}
+inline uint64_t pack_count(const MidiEvent& ev, int cnt_on, int delay_ms) {
+	return static_cast<uint64_t>(delay_ms) << 48 | static_cast<uint64_t>(cnt_on) << 32
+		| static_cast<uint64_t>(ev.evtype) << 24 | ev.ch << 16 | ev.v1 << 8 | ev.v2;
+}
+inline int count_on(uint32_t state) {
+	return state & 0xFFFF;
+}
+inline int count_off(uint32_t state) {
+	return state >> 16;
+}
+// marks that event processing uses rules, see RuleMapper::reload()
+class RulesInUse {
+public:
+	explicit RulesInUse(std::atomic<bool>& flag) :
+		flag(flag) {
+		// sequentially consistent with swap of rules in reload()
+		flag.store(true);
+	}
+	~RulesInUse() {
+		flag.store(false, std::memory_order_release);
+	}
+private:
+	std::atomic<bool>& flag;
+};
+
+inline MidiEvent unpack_count(uint64_t arg, int& cnt_on, int& delay_ms) {
+	MidiEvent ev;
+	delay_ms = static_cast<int>(arg >> 48);
+	cnt_on = static_cast<int>((arg >> 32) & 0xFFFF);
+	ev.evtype = static_cast<MidiEventType>((arg >> 24) & 0xFF);
+	ev.ch = (arg >> 16) & 0xFF;
+	ev.v1 = (arg >> 8) & 0xFF;
+	ev.v2 = arg & 0xFF;
+	return ev;
+}
+}
+
+RuleMapper::RuleMapper(const std::string& fileName, MidiTransport* mc, RuleEngine eng) :
+	midi_client(mc), file_name(fileName), current(new RuleSet(eng)),
+	count_timer(2 * count_keys, [this](int key, uint64_t arg) {
+		int cnt_on, delay_ms;
+		MidiEvent ev = unpack_count(arg, cnt_on, delay_ms);
+		if (key >= count_keys)
+			send_if_held(ev, cnt_on, delay_ms);
+		else
+			count_and_send(ev, cnt_on, CountEnd::TIMEOUT, delay_ms);
+	}), count_timeout(sleep_ms)
 {
-	std::ifstream f(fileName);
-	std::string s;
-	int k = 0;
-	while (getline(f, s)) {
-		try {
-			k++;
-			remove_spaces(s);
-			if (!s.empty())
-				rules.push_back(MidiEventRule(s));
-		}
-		catch (MidiAppError& e) {
-			LogLvl level = e.is_critical() ? LogLvl::ERROR : LogLvl::WARN;
-			LOG(level)
-				<< "Line: " << k << " in " << fileName << " Error: "
-				<< e.what();
+	for (int i = 0; i < count_keys; i++)
+		count_state[i].store(0, std::memory_order_relaxed);
+	current.load()->load(fileName);
+}
 
-		}
-		catch (std::exception& e) {
-			LOG(LogLvl::ERROR)
-				<< "Line: " << k << " in " << fileName << " Error: "
-				<< e.what();
-		}
+RuleMapper::~RuleMapper() {
+	watcher.reset();
+	delete current.load();
+}
+
+void RuleMapper::compile() {
+	current.load()->compile();
+}
+
+void RuleMapper::setEngine(RuleEngine eng) {
+	RuleSet* rs = current.load();
+	rs->engine = eng;
+	rs->clearCompiled();
+}
+
+bool RuleMapper::reload() {
+	std::lock_guard<std::mutex> lock(reload_mutex);
+	std::unique_ptr<RuleSet> fresh(new RuleSet(current.load()->engine));
+	if (fresh->load(file_name) > 0) {
+		LOG(LogLvl::ERROR) << "Rules are not changed, fix errors in: " << file_name;
+		return false;
 	}
-	f.close();
-	LOG(LogLvl::INFO) << "MIDI conversion rules loaded: " << rules.size();
+	// new rules differ from old ones even if they get the same address
+	const uint64_t generation = fresh->generation = ++last_generation;
+	RuleSet* old = current.exchange(fresh.release());
+	LOG(LogLvl::WARN) << "MIDI conversion rules reloaded from: " << file_name << ", rules: " << getSize();
+	wait_unused(generation);
+	delete old;
+	return true;
 }
 
-void RuleMapper::parseString(const std::string& s1) {
-	std::string s(s1);
-	remove_spaces(s);
-	if (!s.empty())
-		rules.push_back(MidiEventRule(s));
+void RuleMapper::wait_unused(uint64_t generation) {
+	// event in progress may still use old rules. Event that starts after the
+	// swap takes new rules, so old ones are free when event processing has
+	// taken new rules or is seen out of applyRules()
+	while (seen_generation.load(std::memory_order_acquire) < generation && rules_in_use.load())
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
 }
 
-int RuleMapper::findMatchingRule(const MidiEvent& ev, int startPos) const {
-	for (size_t i = startPos; i < getSize(); i++) {
-		const MidiEventRule& oneRule = rules[i];
-		if (oneRule.inEventRange->match(ev))
-			return i;
+void RuleMapper::watchFile() {
+	watcher.reset(new FileWatcher(file_name, [this]() { reload(); }));
+	LOG(LogLvl::INFO) << "Watching rule file: " << file_name;
+}
+
+const RuleSet& RuleMapper::active() {
+	const RuleSet* rs = current.load();
+	if (rs->generation != seen_generation.load(std::memory_order_relaxed))
+		adopt(rs);
+	return *rs;
+}
+
+void RuleMapper::adopt(const RuleSet* rs) {
+	// state of COUNT and ONCE rules is kept if those rules are the same
+	std::string count_sig = rs->signature(MidiRuleType::COUNT);
+	std::string once_sig = rs->signature(MidiRuleType::ONCE);
+	const bool first = seen_generation.load(std::memory_order_relaxed) == 0;
+	if (!first && count_sig != seen_count) {
+		LOG(LogLvl::INFO) << "COUNT rules changed, count state reset";
+		reset_count();
+	}
+	if (!first && once_sig != seen_once) {
+		LOG(LogLvl::INFO) << "ONCE rules changed, once state reset";
+		prev_once_ev = MidiEvent();
 	}
-	return -1;
+	seen_count.swap(count_sig);
+	seen_once.swap(once_sig);
+	seen_generation.store(rs->generation, std::memory_order_release);
+}
+
+RuleEngine RuleMapper::engineFromString(const std::string& s) {
+	if (s == "scan")
+		return RuleEngine::SCAN;
+	if (s == "index")
+		return RuleEngine::INDEX;
+	if (s == "simd")
+		return RuleEngine::SIMD;
+	if (s == "table")
+		return RuleEngine::TABLE;
+	if (s == "generated")
+		return RuleEngine::GENERATED;
+	throw MidiAppError("Unknown rule engine: " + s, true);
+}
+
+void RuleMapper::parseString(const std::string& s) {
+	current.load()->add(s);
+}
+
+int RuleMapper::findMatchingRule(const MidiEvent& ev, int startPos) const {
+	return current.load()->findMatchingRule(ev, startPos);
 }
 
 bool RuleMapper::applyRules(MidiEvent& ev) {
 	// returns true if matching rule found
-	bool is_found = false;
-	for (size_t i = 0; i < getSize(); i++) {
-		const MidiEventRule& oneRule = rules[i];
-		is_found = oneRule.inEventRange->match(ev);
-		if (!is_found)
-			continue;
+	RulesInUse in_use(rules_in_use);
+	const RuleSet& rs = active();
+	if (rs.generated != nullptr) {
+		RuleTable::Outcome outcome = rs.generated->apply(ev);
+		if (outcome != RuleTable::Outcome::INTERPRET)
+			return outcome == RuleTable::Outcome::SEND;
+	}
+	else if (rs.table.isBuilt()) {
+		RuleTable::Outcome outcome = rs.table.lookup(ev);
+		if (outcome != RuleTable::Outcome::INTERPRET)
+			return outcome == RuleTable::Outcome::SEND;
+	}
+	return interpret(rs, ev);
+}
+
+bool RuleMapper::interpretRules(MidiEvent& ev) {
+	RulesInUse in_use(rules_in_use);
+	return interpret(active(), ev);
+}
+
+bool RuleMapper::interpret(const RuleSet& rs, MidiEvent& ev) {
+	// event goes to next matching rule after PASS and ONCE, it is sent
+	// only if the last rule in the list matches it
+	const int size = rs.rules.size();
+	int last_found = -1;
+	for (int i = rs.findMatchingRule(ev, 0); i >= 0; i = rs.findMatchingRule(ev, i + 1)) {
+		const MidiEventRule& oneRule = rs.rules[i];
+		last_found = i;
 
 		LOG(LogLvl::DEBUG) << "Found match for event: " << ev.toString()
 			<< ", in rule: " << oneRule.toString();
@@ -68,25 +195,38 @@ bool RuleMapper::applyRules(MidiEvent& ev) {
 				return  false;
 			}
 			LOG(LogLvl::DEBUG) << "Rule type ONCE executed for event: " << prev_once_ev.toString();
-			oneRule.outEventRange->transform(ev);
+			oneRule.outEventRange.transform(ev);
 			continue;
 		}
 		else if (oneRule.ruleType == MidiRuleType::STOP) {
 			LOG(LogLvl::DEBUG) << "Rule STOP executed for event: " << ev.toString();
-			oneRule.outEventRange->transform(ev);
-			return true;
+			oneRule.outEventRange.transform(ev);
+			return send_or_delay(oneRule, ev);
 		}
 		else if (oneRule.ruleType == MidiRuleType::PASS) {
 			LOG(LogLvl::DEBUG) << "Rule PASS executed for event: " << ev.toString();
-			oneRule.outEventRange->transform(ev);
+			oneRule.outEventRange.transform(ev);
 			continue;
 		}
 		else if (oneRule.ruleType == MidiRuleType::COUNT) {
 			LOG(LogLvl::DEBUG) << "Rule COUNT executed for event: " << ev.toString();
-			update_count(ev);
-			bool send_it = count_on == 1 && count_off == 0; // send only 1-st ON for original ev
-			if (ev.isNoteOn()) {
-				std::thread(&RuleMapper::count_and_send, this, ev, count_on).detach();
+			uint32_t state = update_count(ev);
+			// send only 1-st ON of a series for original ev
+			bool send_it = count_on(state) == 1 && count_off(state) == 0;
+			if (!ev.isNoteOn())
+				return send_it;
+			int ms = count_timeout.tap(count_key(ev), count_timer.getClock().now(), count_on(state) > 1);
+			if (oneRule.maxCount > 0 && count_on(state) >= oneRule.maxCount) {
+				// series is complete, it does not wait for timeout
+				count_timer.cancel(count_key(ev));
+				count_and_send(ev, count_on(state), CountEnd::MAX_COUNT, oneRule.delayMs);
+			}
+			else {
+				count_timer.schedule(count_key(ev), ms, pack_count(ev, count_on(state), oneRule.delayMs));
+				// held note ends series at hold time, not after release and timeout
+				if (oneRule.holdMs > 0 && oneRule.holdMs < ms)
+					count_timer.schedule(count_keys + count_key(ev), oneRule.holdMs,
+						pack_count(ev, count_on(state), oneRule.delayMs));
 			}
 			return send_it;
 		}
@@ -94,61 +234,96 @@ bool RuleMapper::applyRules(MidiEvent& ev) {
 			throw MidiAppError("Unknown rule type: " + oneRule.toString());
 		}
 	}
-	return is_found;
-}
-void RuleMapper::update_count(const MidiEvent& ev) {
-	// if we got another note number, restart count
-	if (!prev_count_ev.isSimilar(ev)) {
-		LOG(LogLvl::DEBUG) << "New count event, count reset: "
-			<< ev.toString();
-		count_on = count_off = 0;
-		prev_count_ev = ev;
-	}
+	return last_found >= 0 && last_found == size - 1;
+}
 
-	if (ev.isNoteOn()) {
-		count_on++;
-	}
-	else if (count_on > 0) {
-		count_off++;
-	}
+bool RuleMapper::send_or_delay(const MidiEventRule& rule, const MidiEvent& ev) const {
+	// delayed event is given to transport here, caller does not send it
+	if (rule.delayMs == 0)
+		return true;
+	LOG(LogLvl::DEBUG) << "Event is sent after " << rule.delayMs << " ms: " << ev.toString();
+	make_and_send(ev, false, rule.delayMs);
+	return false;
+}
+uint32_t RuleMapper::update_count(const MidiEvent& ev) {
+	std::atomic<uint32_t>& slot = count_state[count_key(ev)];
+	uint32_t state = slot.load(std::memory_order_acquire);
+	uint32_t next;
+	do {
+		int on = count_on(state), off = count_off(state);
+		if (ev.isNoteOn())
+			on = std::min(on + 1, 0xFFFF);
+		else if (on > 0)
+			off = std::min(off + 1, 0xFFFF);
+		else
+			return state; // note OFF without ON is not counted
+		next = static_cast<uint32_t>(off) << 16 | on;
+	} while (!slot.compare_exchange_weak(state, next, std::memory_order_acq_rel));
+	return next;
 }
 
-void RuleMapper::count_and_send(const MidiEvent& ev, int cnt_on) {
-	std::this_thread::sleep_for(
-		std::chrono::milliseconds(RuleMapper::sleep_ms));
-	if (count_on != cnt_on) {
-		LOG(LogLvl::DEBUG) << "Delayed check, count changed: " << count_on
+void RuleMapper::count_and_send(const MidiEvent& ev, int cnt_on, CountEnd end, int delay_ms) {
+	// called by count_timer timeout after the last note ON, or at once
+	// when series reaches max count
+	std::atomic<uint32_t>& slot = count_state[count_key(ev)];
+	uint32_t state = slot.load(std::memory_order_acquire);
+	if (count_on(state) != cnt_on) {
+		LOG(LogLvl::DEBUG) << "Delayed check, count changed: " << count_on(state)
 			<< " vs. " << cnt_on;
+		return;
 	}
-	else if (!prev_count_ev.isSimilar(ev)) {
-		LOG(LogLvl::DEBUG) << "Delayed check, new note: " << ev.toString()
-			<< " vs. " << prev_count_ev.toString();
+	// series is over, tap that comes at the same time starts a new one
+	if (!slot.compare_exchange_strong(state, 0, std::memory_order_acq_rel)) {
+		LOG(LogLvl::DEBUG) << "Delayed check, count changed: " << ev.toString();
+		return;
 	}
-	else {
-		midi_byte_t counted_v2 = count_on
-			+ (count_on > count_off ? 5 : 0);
-		MidiEvent ev_new = ev;
-		ev_new.v2 = counted_v2;
-		count_on = count_off = 0;
-		LOG(LogLvl::INFO) << "Delayed check, send counted note: "
-			<< ev_new.toString();
-		make_and_send(ev_new);
+	// only a series that ended on timeout may be followed by a missed tap
+	count_timeout.series_end(count_key(ev), end == CountEnd::TIMEOUT);
+	MidiEvent ev_new = ev;
+	// completed series ends on note ON, it can not be held. It is sent by
+	// event processing with output of its batch, timer thread sends directly
+	const bool completed = end == CountEnd::MAX_COUNT;
+	ev_new.v2 = count_on(state) + (!completed && count_on(state) > count_off(state) ? 5 : 0);
+	LOG(LogLvl::INFO) << "Delayed check, send counted note: "
+		<< ev_new.toString();
+	make_and_send(ev_new, completed, delay_ms);
+}
+
+void RuleMapper::send_if_held(const MidiEvent& ev, int cnt_on, int delay_ms) {
+	// called by count_timer hold time after note ON. Released note waits
+	// for timeout, timers of both kinds are re-armed by next note ON
+	uint32_t state = count_state[count_key(ev)].load(std::memory_order_acquire);
+	if (count_on(state) != cnt_on || count_off(state) >= count_on(state))
+		return;
+	LOG(LogLvl::DEBUG) << "Note is held, count series ends: " << ev.toString();
+	count_and_send(ev, cnt_on, CountEnd::HOLD, delay_ms);
+}
+
+void RuleMapper::reset_count() {
+	for (int i = 0; i < count_keys; i++) {
+		if (count_state[i].exchange(0, std::memory_order_acq_rel) != 0) {
+			count_timer.cancel(i);
+			count_timer.cancel(count_keys + i);
+		}
 	}
 }
 
 std::string RuleMapper::toString() const {
-	std::ostringstream ss;
-	for (size_t i = 0; i < getSize(); i++) {
-		ss << "#" << i << '\t' << rules[i].toString() << std::endl;
-	}
-	return ss.str();
+	return current.load()->toString();
 }
 
-void RuleMapper::make_and_send(const MidiEvent& ev) const {
+void RuleMapper::make_and_send(const MidiEvent& ev, bool queued, int delay_ms) const {
+	if (midi_client == nullptr) // rules tested or measured without MIDI ports
+		return;
 	snd_seq_event_t event;
 	snd_seq_ev_clear(&event);
 	if (!writeMidiEvent(&event, ev)) {
 		LOG(LogLvl::ERROR) << "Failed to write event: " << ev.toString();
 	};
-	midi_client->send_event(&event);
+	if (delay_ms > 0)
+		midi_client->schedule_event(&event, delay_ms);
+	else if (queued)
+		midi_client->queue_event(&event);
+	else
+		midi_client->send_event(&event);
 }
\ No newline at end of file
@@ -3,47 +3,118 @@
 #include "pch.hpp"
 #include "MidiEvent.hpp"
 #include "lib/utils.hpp"
-#include "MidiClient.hpp"
-
-
+#include "MidiTransport.hpp"
+#include "RuleSet.hpp"
+#include "CountTimeout.hpp"
+#include "lib/timer_wheel.hpp"
+#include "lib/file_watch.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
 
 
 class RuleMapper {
 private:
 	static const int sleep_ms;
-	const MidiClient* midi_client;
+	const MidiTransport* midi_client;
 public:
-	RuleMapper(const std::string& fileName, MidiClient* mc);
+	RuleMapper(const std::string& fileName, MidiTransport* mc, RuleEngine eng = RuleEngine::TABLE);
+	virtual ~RuleMapper();
+	// setup of rules, not safe while events are processed
 	int findMatchingRule(const MidiEvent&, int startPos = 0) const;
 	void parseString(const std::string&);
+	void compile();
+	bool isCompiled() const {
+		return current.load()->isCompiled();
+	}
+	void setEngine(RuleEngine eng);
+	RuleEngine getEngine() const {
+		return current.load()->used;
+	}
+	static RuleEngine engineFromString(const std::string& s);
+
+	// reads rule file again, compiles and publishes new rules, returns false
+	// and keeps old rules if file has errors. Safe while events are processed
+	bool reload();
+	// reload() when rule file is changed
+	void watchFile();
+
 	bool applyRules(MidiEvent& ev);
-	const MidiClient* get_midi_client() const {
+	bool interpretRules(MidiEvent& ev);
+	const MidiTransport* get_midi_client() const {
 		return midi_client;
 	}
+	TimerWheel& get_count_timer() {
+		return count_timer;
+	}
+	// COUNT series timeout, fixed or learned from taps
+	CountTimeout& get_count_timeout() {
+		return count_timeout;
+	}
+	// clock of COUNT timers, with virtual clock expired timers fire when
+	// get_count_timer().advance() is called
+	void setClock(const Clock& c) {
+		count_timer.setClock(c);
+	}
 
 	MidiEventRule& getRule(int i) {
-		return rules[i];
+		return current.load()->rules[i];
 	}
 	size_t getSize() const {
-		return rules.size();
+		return current.load()->rules.size();
 	}
 	std::string toString() const;
 
-	void make_and_send(const MidiEvent& ev) const;
+	// queued output is sent by MidiTransport::flush_output(), delayed output
+	// is kept by transport (ALSA queue) until its time
+	void make_and_send(const MidiEvent& ev, bool queued = false, int delay_ms = 0) const;
 
 private:
+	const std::string file_name;
 
-	//time_point prev_moment = the_clock::now();
-	MidiEvent prev_count_ev;
 	MidiEvent prev_once_ev;
 
-	int count_on = 0;
-	int count_off = 0;
+	// COUNT state of every key (channel, note): count of note ON in low 16
+	// bits and note OFF in high 16 bits. Event processing adds taps and the
+	// timer takes finished series with atomic compare and swap, so keys are
+	// counted at the same time and the two never wait for each other
+	static const int count_keys = 16 * 128;
+	std::atomic<uint32_t> count_state[count_keys];
+
+	// rules used by event processing, replaced by reload() with atomic swap.
+	// Old rules are deleted when event processing has taken new ones or is
+	// out of applyRules(), so no event can use them
+	std::atomic<RuleSet*> current;
+	std::mutex reload_mutex;
+	uint64_t last_generation = 1; // of rules published by reload()
+	// set by event processing while it uses rules
+	std::atomic<bool> rules_in_use { false };
+	// generation of rules whose state event processing has, written only by it
+	std::atomic<uint64_t> seen_generation { 0 };
+	std::string seen_count, seen_once;
+
+	const RuleSet& active();
+	void adopt(const RuleSet* rs);
+	void wait_unused(uint64_t generation);
+	bool interpret(const RuleSet& rs, MidiEvent& ev);
 
-	std::vector<MidiEventRule> rules;
+	// two timers per counted note: timeout of the key after the last tap
+	// and hold time of the rule, keys of hold timers start at count_keys
+	TimerWheel count_timer;
+	CountTimeout count_timeout;
+	std::unique_ptr<FileWatcher> watcher;
 
-	void update_count(const MidiEvent& ev);
-	void count_and_send(const MidiEvent& ev, int cnt_on);
+	// how count series ended
+	enum class CountEnd {
+		TIMEOUT, HOLD, MAX_COUNT
+	};
+	// returns state of the key after the event
+	uint32_t update_count(const MidiEvent& ev);
+	void count_and_send(const MidiEvent& ev, int cnt_on, CountEnd end, int delay_ms);
+	void send_if_held(const MidiEvent& ev, int cnt_on, int delay_ms);
+	// true if event is to be sent now, rule with delay sends it later itself
+	bool send_or_delay(const MidiEventRule& rule, const MidiEvent& ev) const;
+	void reset_count();
 
 };
 
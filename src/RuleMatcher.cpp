@@ -0,0 +1,171 @@
+#include "RuleMatcher.hpp"
+
+#if defined(__SSE2__)
+// AVX2 code is built for its functions only and used if the CPU has it,
+// SSE2 matches a block of 32 rules in two halves
+#include <immintrin.h>
+const size_t RuleMatcher::lanes = 32;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+const size_t RuleMatcher::lanes = 16;
+#else
+const size_t RuleMatcher::lanes = 16;
+#endif
+
+namespace {
+const midi_byte_t any_type = static_cast<midi_byte_t>(MidiEventType::ANYTHING);
+
+// columns of input ranges starting at the first rule of a block
+struct Block {
+	const midi_byte_t *type, *ch_lo, *ch_hi, *v1_lo, *v1_hi, *v2_lo, *v2_hi;
+};
+
+#if defined(__SSE2__)
+bool detect_avx2() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+const bool has_avx2 = detect_avx2();
+
+__attribute__((target("avx2")))
+uint32_t match_avx2(const Block& b, const MidiEvent& ev) {
+#define LOAD(a) _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b.a))
+	// lower <= v if max(lower, v) == v, v <= upper if min(upper, v) == v
+	const __m256i vt = _mm256_set1_epi8(static_cast<midi_byte_t>(ev.evtype)), va = _mm256_set1_epi8(any_type);
+	const __m256i vc = _mm256_set1_epi8(ev.ch), v1 = _mm256_set1_epi8(ev.v1), v2 = _mm256_set1_epi8(ev.v2);
+	const __m256i rt = LOAD(type);
+	__m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(rt, vt), _mm256_cmpeq_epi8(rt, va));
+	m = _mm256_and_si256(m, _mm256_cmpeq_epi8(_mm256_max_epu8(LOAD(ch_lo), vc), vc));
+	m = _mm256_and_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(LOAD(ch_hi), vc), vc));
+	m = _mm256_and_si256(m, _mm256_cmpeq_epi8(_mm256_max_epu8(LOAD(v1_lo), v1), v1));
+	m = _mm256_and_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(LOAD(v1_hi), v1), v1));
+	m = _mm256_and_si256(m, _mm256_cmpeq_epi8(_mm256_max_epu8(LOAD(v2_lo), v2), v2));
+	m = _mm256_and_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(LOAD(v2_hi), v2), v2));
+	return static_cast<uint32_t>(_mm256_movemask_epi8(m));
+#undef LOAD
+}
+
+// 16 rules starting at offset k of the block
+uint32_t match_sse2(const Block& b, size_t k, const MidiEvent& ev) {
+#define LOAD(a) _mm_loadu_si128(reinterpret_cast<const __m128i*>(b.a + k))
+	const __m128i vt = _mm_set1_epi8(static_cast<midi_byte_t>(ev.evtype)), va = _mm_set1_epi8(any_type);
+	const __m128i vc = _mm_set1_epi8(ev.ch), v1 = _mm_set1_epi8(ev.v1), v2 = _mm_set1_epi8(ev.v2);
+	const __m128i rt = LOAD(type);
+	__m128i m = _mm_or_si128(_mm_cmpeq_epi8(rt, vt), _mm_cmpeq_epi8(rt, va));
+	m = _mm_and_si128(m, _mm_cmpeq_epi8(_mm_max_epu8(LOAD(ch_lo), vc), vc));
+	m = _mm_and_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(LOAD(ch_hi), vc), vc));
+	m = _mm_and_si128(m, _mm_cmpeq_epi8(_mm_max_epu8(LOAD(v1_lo), v1), v1));
+	m = _mm_and_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(LOAD(v1_hi), v1), v1));
+	m = _mm_and_si128(m, _mm_cmpeq_epi8(_mm_max_epu8(LOAD(v2_lo), v2), v2));
+	m = _mm_and_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(LOAD(v2_hi), v2), v2));
+	return static_cast<uint32_t>(_mm_movemask_epi8(m));
+#undef LOAD
+}
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+inline uint32_t movemask(uint8x16_t m) {
+	static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+	uint8x16_t b = vandq_u8(m, vld1q_u8(weights));
+	uint8x8_t s = vpadd_u8(vget_low_u8(b), vget_high_u8(b));
+	s = vpadd_u8(s, s);
+	s = vpadd_u8(s, s);
+	return vget_lane_u16(vreinterpret_u16_u8(s), 0);
+}
+#endif
+}
+
+const char* RuleMatcher::instructionSet() {
+#if defined(__SSE2__)
+	return has_avx2 ? "avx2" : "sse2";
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	return "neon";
+#else
+	return "scalar";
+#endif
+}
+
+void RuleMatcher::clear() {
+	for (auto v : { &type, &ch_lo, &ch_hi, &v1_lo, &v1_hi, &v2_lo, &v2_hi })
+		std::vector<midi_byte_t>().swap(*v);
+	count = 0;
+	built = false;
+}
+
+void RuleMatcher::build(const std::vector<MidiEventRule>& rules) {
+	clear();
+	count = rules.size();
+	size_t padded = (count + lanes - 1) / lanes * lanes;
+	// padding rules never match: type is zero and lower > upper
+	type.assign(padded, 0);
+	ch_lo.assign(padded, 1);
+	v1_lo.assign(padded, 1);
+	v2_lo.assign(padded, 1);
+	ch_hi.assign(padded, 0);
+	v1_hi.assign(padded, 0);
+	v2_hi.assign(padded, 0);
+	for (size_t i = 0; i < count; i++) {
+		const InMidiEventRange& in = rules[i].inEventRange;
+		type[i] = static_cast<midi_byte_t>(in.evtype);
+		ch_lo[i] = in.ch.lower;
+		ch_hi[i] = in.ch.upper;
+		v1_lo[i] = in.v1.lower;
+		v1_hi[i] = in.v1.upper;
+		v2_lo[i] = in.v2.lower;
+		v2_hi[i] = in.v2.upper;
+	}
+	built = true;
+}
+
+uint32_t RuleMatcher::matchBlock(const MidiEvent& ev, size_t block) const {
+	const size_t k = block * lanes;
+	const Block b = { &type[k], &ch_lo[k], &ch_hi[k], &v1_lo[k], &v1_hi[k], &v2_lo[k], &v2_hi[k] };
+#if defined(__SSE2__)
+	if (has_avx2)
+		return match_avx2(b, ev);
+	return match_sse2(b, 0, ev) | match_sse2(b, 16, ev) << 16;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define LOAD(a) vld1q_u8(b.a)
+	const midi_byte_t t = static_cast<midi_byte_t>(ev.evtype);
+	const uint8x16_t vc = vdupq_n_u8(ev.ch), v1 = vdupq_n_u8(ev.v1), v2 = vdupq_n_u8(ev.v2);
+	const uint8x16_t rt = LOAD(type);
+	uint8x16_t m = vorrq_u8(vceqq_u8(rt, vdupq_n_u8(t)), vceqq_u8(rt, vdupq_n_u8(any_type)));
+	m = vandq_u8(m, vcleq_u8(LOAD(ch_lo), vc));
+	m = vandq_u8(m, vcleq_u8(vc, LOAD(ch_hi)));
+	m = vandq_u8(m, vcleq_u8(LOAD(v1_lo), v1));
+	m = vandq_u8(m, vcleq_u8(v1, LOAD(v1_hi)));
+	m = vandq_u8(m, vcleq_u8(LOAD(v2_lo), v2));
+	m = vandq_u8(m, vcleq_u8(v2, LOAD(v2_hi)));
+	return movemask(m);
+#undef LOAD
+#else
+	const midi_byte_t t = static_cast<midi_byte_t>(ev.evtype);
+	uint32_t m = 0;
+	for (size_t i = 0; i < lanes; i++) {
+		bool ok = (b.type[i] == t || b.type[i] == any_type)
+			&& b.ch_lo[i] <= ev.ch && ev.ch <= b.ch_hi[i]
+			&& b.v1_lo[i] <= ev.v1 && ev.v1 <= b.v1_hi[i]
+			&& b.v2_lo[i] <= ev.v2 && ev.v2 <= b.v2_hi[i];
+		m |= static_cast<uint32_t>(ok) << i;
+	}
+	return m;
+#endif
+}
+
+int RuleMatcher::findMatchingRule(const MidiEvent& ev, int startPos) const {
+	if (startPos < 0)
+		startPos = 0;
+	const size_t blocks = type.size() / lanes;
+	size_t block = startPos / lanes;
+	if (block >= blocks)
+		return -1;
+	// skip rules before startPos in the first block
+	uint32_t m = matchBlock(ev, block) & (~0u << (startPos % lanes));
+	while (true) {
+		if (m != 0)
+			return static_cast<int>(block * lanes + __builtin_ctz(m));
+		if (++block >= blocks)
+			return -1;
+		m = matchBlock(ev, block);
+	}
+}
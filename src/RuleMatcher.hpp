@@ -0,0 +1,35 @@
+#ifndef RULEMATCHER_H
+#define RULEMATCHER_H
+
+#include "pch.hpp"
+#include "MidiEvent.hpp"
+
+// Input ranges of all rules kept as arrays of bytes (structure of arrays).
+// One event is compared with a block of rules at once using SIMD
+// instructions (AVX2 if the CPU has it, else SSE2, or NEON), result of a
+// block is a bit mask of matching rules. Without SIMD support the same
+// blocks are matched in a loop.
+class RuleMatcher {
+public:
+	// number of rules matched in one block
+	static const size_t lanes;
+
+	void build(const std::vector<MidiEventRule>& rules);
+	void clear();
+	bool isBuilt() const {
+		return built;
+	}
+	// returns index of first rule at or after startPos that matches event, -1 if none
+	int findMatchingRule(const MidiEvent& ev, int startPos) const;
+	// bit mask of matching rules in a block, bit 0 is rule block * lanes
+	uint32_t matchBlock(const MidiEvent& ev, size_t block) const;
+
+	static const char* instructionSet();
+
+private:
+	size_t count = 0;
+	bool built = false;
+	std::vector<midi_byte_t> type, ch_lo, ch_hi, v1_lo, v1_hi, v2_lo, v2_hi;
+};
+
+#endif
@@ -0,0 +1,162 @@
+#include "RuleSet.hpp"
+#include "RuleCache.hpp"
+#include "lib/utils.hpp"
+#include <algorithm>
+#include <cstring>
+
+size_t RuleSet::readFile(const std::string& fileName) {
+	std::string text;
+	read_file(fileName, text);
+	return parseText(text, fileName);
+}
+
+size_t RuleSet::load(const std::string& fileName) {
+	std::string text;
+	if (!read_file(fileName, text) || text.empty()) {
+		compile();
+		return 0;
+	}
+	const uint64_t hash = rule_text_hash(text);
+	const std::string cacheFile = rule_cache_name(fileName);
+	if (rules.empty() && load_rule_cache(cacheFile, hash, *this)) {
+		LOG(LogLvl::INFO) << "MIDI conversion rules loaded from cache: " << rules.size();
+		text_hash = hash;
+		const bool has_table = table.isBuilt();
+		compile();
+		if (engine == RuleEngine::TABLE && !has_table)
+			save_rule_cache(cacheFile, hash, *this);
+		return 0;
+	}
+	size_t errors = parseText(text, fileName);
+	compile();
+	// rules of file with errors are not cached, errors are shown on every start
+	if (errors == 0 && !save_rule_cache(cacheFile, hash, *this)) {
+		LOG(LogLvl::INFO) << "Cannot write rule cache: " << cacheFile;
+	}
+	return errors;
+}
+
+size_t RuleSet::parseText(const std::string& text, const std::string& fileName) {
+	const uint64_t hash = rules.empty() ? rule_text_hash(text) : 0;
+	// lines are parsed in place
+	rules.reserve(rules.size() + std::count(text.begin(), text.end(), '\n') + 1);
+
+	const char* p = text.data();
+	const char* const end = p + text.size();
+	int k = 0;
+	size_t errors = 0;
+	while (p < end) {
+		const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+		TextSpan line(p, eol == nullptr ? end : eol);
+		p = line.end + 1;
+		try {
+			k++;
+			if (!line.code().blank())
+				rules.push_back(MidiEventRule(line));
+		}
+		catch (MidiAppError& e) {
+			LogLvl level = e.is_critical() ? LogLvl::ERROR : LogLvl::WARN;
+			LOG(level)
+				<< "Line: " << k << " in " << fileName << " Error: "
+				<< e.what();
+			errors++;
+		}
+		catch (std::exception& e) {
+			LOG(LogLvl::ERROR)
+				<< "Line: " << k << " in " << fileName << " Error: "
+				<< e.what();
+			errors++;
+		}
+	}
+	LOG(LogLvl::INFO) << "MIDI conversion rules loaded: " << rules.size();
+	clearCompiled();
+	text_hash = hash;
+	return errors;
+}
+
+void RuleSet::add(const std::string& s) {
+	TextSpan line(s);
+	if (!line.code().blank()) {
+		rules.push_back(MidiEventRule(line));
+		clearCompiled();
+		text_hash = 0;
+	}
+}
+
+void RuleSet::compile() {
+	auto start = std::chrono::steady_clock::now();
+	generated = nullptr;
+	used = engine;
+	if (used == RuleEngine::GENERATED) {
+		const GeneratedRules* g = generated_rules();
+		if (g != nullptr && g->text_hash == text_hash && g->rule_count == rules.size()) {
+			generated = g;
+			LOG(LogLvl::INFO) << "Rules use code generated from: " << g->file_name;
+		}
+		else {
+			LOG(LogLvl::WARN) << "Generated rule code is not for these rules, rule table is used";
+			used = RuleEngine::TABLE;
+		}
+	}
+	// table attached from rule cache is kept, rule changes reset the cache image
+	if (image == nullptr || used != RuleEngine::TABLE)
+		table.clear();
+	index.clear();
+	matcher.clear();
+	if (used == RuleEngine::TABLE && !table.isBuilt())
+		table.build(rules);
+	if (used == RuleEngine::TABLE || used == RuleEngine::INDEX || used == RuleEngine::GENERATED)
+		index.build(rules);
+	if (used == RuleEngine::SIMD)
+		matcher.build(rules);
+	compiled = true;
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	LOG(LogLvl::INFO) << "MIDI conversion rules compiled in " << ms << " ms";
+	if (table.isBuilt()) {
+		LOG(LogLvl::INFO) << "Rule table events left to interpreter: " << table.interpretCount();
+	}
+	if (matcher.isBuilt()) {
+		LOG(LogLvl::INFO) << "Rule matcher uses: " << RuleMatcher::instructionSet();
+	}
+}
+
+void RuleSet::clearCompiled() {
+	image.reset();
+	generated = nullptr;
+	used = engine;
+	table.clear();
+	index.clear();
+	matcher.clear();
+	compiled = false;
+}
+
+int RuleSet::findMatchingRule(const MidiEvent& ev, int startPos) const {
+	if (index.isBuilt())
+		return index.findMatchingRule(rules, ev, startPos);
+	if (matcher.isBuilt())
+		return matcher.findMatchingRule(ev, startPos);
+	for (size_t i = startPos; i < rules.size(); i++) {
+		const MidiEventRule& oneRule = rules[i];
+		if (oneRule.inEventRange.match(ev))
+			return i;
+	}
+	return -1;
+}
+
+std::string RuleSet::signature(MidiRuleType t) const {
+	std::ostringstream ss;
+	for (const MidiEventRule& rule : rules) {
+		if (rule.ruleType == t)
+			ss << rule.toString() << '\n';
+	}
+	return ss.str();
+}
+
+std::string RuleSet::toString() const {
+	std::ostringstream ss;
+	for (size_t i = 0; i < rules.size(); i++) {
+		ss << "#" << i << '\t' << rules[i].toString() << std::endl;
+	}
+	return ss.str();
+}
@@ -0,0 +1,66 @@
+#ifndef RULESET_H
+#define RULESET_H
+
+#include "pch.hpp"
+#include "MidiEvent.hpp"
+#include "RuleTable.hpp"
+#include "RuleIndex.hpp"
+#include "RuleMatcher.hpp"
+#include "GeneratedRules.hpp"
+#include <memory>
+
+
+// How rules are matched to event: scan of all rules, index by event type and channel,
+// SIMD matcher, precomputed table or C++ code generated from rule file, both
+// with index for rules that keep state
+enum class RuleEngine {
+	SCAN, INDEX, SIMD, TABLE, GENERATED
+};
+
+// List of rules and its compiled form. After a rule set is published to
+// event processing it is not changed, reload makes a new one.
+class RuleSet {
+public:
+	explicit RuleSet(RuleEngine eng) :
+		engine(eng), used(eng) {
+	}
+
+	// adds rules of the file, returns number of lines with errors
+	size_t readFile(const std::string& fileName);
+	// adds rules of the text, file name is for error messages
+	size_t parseText(const std::string& text, const std::string& fileName);
+	// reads and compiles rules of the file using rule cache next to it,
+	// cache is written again if it is older than the file
+	size_t load(const std::string& fileName);
+	// adds one rule, throws MidiAppError if rule is not valid
+	void add(const std::string& s);
+	void compile();
+	void clearCompiled();
+	bool isCompiled() const {
+		return compiled;
+	}
+	int findMatchingRule(const MidiEvent& ev, int startPos) const;
+	// rules of one type as text, it is the same if those rules are not changed
+	std::string signature(MidiRuleType t) const;
+	std::string toString() const;
+
+	std::vector<MidiEventRule> rules;
+	RuleEngine engine; // requested, reload keeps it
+	RuleEngine used; // set by compile(), TABLE if generated code is not for these rules
+	RuleTable table;
+	RuleIndex index;
+	RuleMatcher matcher;
+	// mapped rule cache, attached table is in it
+	std::shared_ptr<const void> image;
+	// code of GENERATED engine, it is checked by hash of rule text
+	const GeneratedRules* generated = nullptr;
+	// hash of text that rules were read from, 0 if rules are added one by one
+	uint64_t text_hash = 0;
+	// number of rule set in RuleMapper, it grows with every reload
+	uint64_t generation = 1;
+
+private:
+	bool compiled = false;
+};
+
+#endif
@@ -0,0 +1,125 @@
+#include "RuleTable.hpp"
+
+namespace {
+
+// Result of the rule chain for one event, keep_* flags are set
+// if the field of the result is the same as in the input event.
+struct ChainResult {
+	bool done = false;
+	RuleTable::Outcome outcome = RuleTable::Outcome::DROP;
+	MidiEvent ev;
+	bool keep_type = true, keep_ch = true, keep_v1 = true, keep_v2 = true;
+};
+
+void run_chain(const std::vector<MidiEventRule>& rules, const MidiEvent& in, ChainResult& r) {
+	// same logic as RuleMapper::applyRules for PASS and STOP rules
+	r.ev = in;
+	bool is_found = false;
+	for (size_t i = 0; i < rules.size(); i++) {
+		const MidiEventRule& oneRule = rules[i];
+		is_found = oneRule.inEventRange.match(r.ev);
+		if (!is_found)
+			continue;
+		bool stateless = oneRule.ruleType == MidiRuleType::PASS || oneRule.ruleType == MidiRuleType::STOP;
+		// delayed output is sent by interpreter
+		if (!stateless || oneRule.delayMs > 0) {
+			r.outcome = RuleTable::Outcome::INTERPRET;
+			return;
+		}
+		const OutMidiEventRange& out = oneRule.outEventRange;
+		out.transform(r.ev);
+		r.keep_type = r.keep_type && out.evtype == MidiEventType::ANYTHING;
+		r.keep_ch = r.keep_ch && out.ch.lower != out.ch.upper;
+		r.keep_v1 = r.keep_v1 && out.v1.lower != out.v1.upper;
+		r.keep_v2 = r.keep_v2 && out.v2.lower != out.v2.upper;
+		if (oneRule.ruleType == MidiRuleType::STOP) {
+			r.outcome = RuleTable::Outcome::SEND;
+			return;
+		}
+	}
+	r.outcome = is_found ? RuleTable::Outcome::SEND : RuleTable::Outcome::DROP;
+}
+
+// Split values 0..count-1 into classes by boundaries of rule ranges.
+// Values of one class give the same matches for every rule, so the chain
+// is run once per class and the result reused for all its values.
+int make_classes(const std::vector<bool>& cut, std::vector<int>& cls) {
+	int k = -1;
+	cls.resize(cut.size() - 1);
+	for (size_t i = 0; i < cls.size(); i++) {
+		if (i == 0 || cut[i])
+			k++;
+		cls[i] = k;
+	}
+	return k + 1;
+}
+
+template<midi_byte_t max>
+void add_cut(std::vector<bool>& cut, const MidiRange<max>& r) {
+	cut[r.lower] = true;
+	cut[r.upper + 1] = true;
+}
+
+}
+
+void RuleTable::build(const std::vector<MidiEventRule>& rules) {
+	const MidiEventType types[type_count] = { MidiEventType::NOTE,
+		MidiEventType::CONTROLCHANGE, MidiEventType::PROGCHANGE };
+
+	std::vector<bool> ch_cut(ch_count + 1), v1_cut(value_count + 1), v2_cut(value_count + 1);
+	for (size_t i = 0; i < rules.size(); i++) {
+		const InMidiEventRange& in = rules[i].inEventRange;
+		add_cut(ch_cut, in.ch);
+		add_cut(v1_cut, in.v1);
+		add_cut(v2_cut, in.v2);
+	}
+	std::vector<int> ch_cls, v1_cls, v2_cls;
+	int n_ch = make_classes(ch_cut, ch_cls);
+	int n_v1 = make_classes(v1_cut, v1_cls);
+	int n_v2 = make_classes(v2_cut, v2_cls);
+
+	std::vector<ChainResult> memo(type_count * n_ch * n_v1 * n_v2);
+	entries.assign(entry_count, Entry());
+	MidiEvent ev;
+	for (int t = 0; t < type_count; t++) {
+		ev.evtype = types[t];
+		for (int ch = 0; ch < ch_count; ch++) {
+			ev.ch = ch;
+			for (int v1 = 0; v1 < value_count; v1++) {
+				ev.v1 = v1;
+				for (int v2 = 0; v2 < value_count; v2++) {
+					ev.v2 = v2;
+					ChainResult& r = memo[((t * n_ch + ch_cls[ch]) * n_v1 + v1_cls[v1]) * n_v2 + v2_cls[v2]];
+					if (!r.done) {
+						run_chain(rules, ev, r);
+						r.done = true;
+					}
+					Entry& e = entries[index(t, ch, v1, v2)];
+					e.outcome = r.outcome;
+					e.evtype = r.keep_type ? ev.evtype : r.ev.evtype;
+					e.ch = r.keep_ch ? ev.ch : r.ev.ch;
+					e.v1 = r.keep_v1 ? ev.v1 : r.ev.v1;
+					e.v2 = r.keep_v2 ? ev.v2 : r.ev.v2;
+				}
+			}
+		}
+	}
+	table = entries.data();
+}
+
+size_t RuleTable::interpretCount() const {
+	size_t n = 0;
+	for (size_t i = 0; table != nullptr && i < entry_count; i++) {
+		if (table[i].outcome == Outcome::INTERPRET)
+			n++;
+	}
+	return n;
+}
+
+bool RuleTable::attach(const void* p, size_t size) {
+	clear();
+	if (p == nullptr || size != dataSize())
+		return false;
+	table = static_cast<const Entry*>(p);
+	return true;
+}
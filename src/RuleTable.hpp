@@ -0,0 +1,84 @@
+#ifndef RULETABLE_H
+#define RULETABLE_H
+
+#include "pch.hpp"
+#include "MidiEvent.hpp"
+
+// Outcome of the rule chain precomputed for every input event (type, channel, v1, v2).
+// Only PASS and STOP rules are tabulated, events that reach a rule with
+// state (COUNT, ONCE) are marked to go through the interpreter.
+class RuleTable {
+public:
+	enum class Outcome : midi_byte_t {
+		DROP, SEND, INTERPRET
+	};
+
+	void build(const std::vector<MidiEventRule>& rules);
+	void clear() {
+		std::vector<Entry>().swap(entries);
+		table = nullptr;
+	}
+	bool isBuilt() const {
+		return table != nullptr;
+	}
+	size_t interpretCount() const;
+
+	// table as bytes, to save it in rule cache
+	const void* data() const {
+		return table;
+	}
+	static size_t dataSize() {
+		return entry_count * sizeof(Entry);
+	}
+	static size_t entrySize() {
+		return sizeof(Entry);
+	}
+	// uses table saved before, memory is not copied and must stay while
+	// table is used, returns false if size is not right
+	bool attach(const void* p, size_t size);
+
+	// for DROP and SEND event is replaced with result of the rule chain
+	inline Outcome lookup(MidiEvent& ev) const {
+		int t = typeIndex(ev.evtype);
+		if (t < 0 || ev.ch > MIDI_MAXCH || ev.v1 > MIDI_MAX || ev.v2 > MIDI_MAX)
+			return Outcome::INTERPRET;
+		const Entry& e = table[index(t, ev.ch, ev.v1, ev.v2)];
+		if (e.outcome == Outcome::INTERPRET)
+			return Outcome::INTERPRET;
+		ev.evtype = e.evtype;
+		ev.ch = e.ch;
+		ev.v1 = e.v1;
+		ev.v2 = e.v2;
+		return e.outcome;
+	}
+
+private:
+	// types of events that come from MIDI input: note, cc, program change
+	static const int type_count = 3;
+	static const int ch_count = 16;
+	static const int value_count = 128;
+	static const size_t entry_count = type_count * ch_count * value_count * value_count;
+
+	struct Entry {
+		Outcome outcome;
+		MidiEventType evtype;
+		midi_byte_t ch, v1, v2;
+	};
+	std::vector<Entry> entries;
+	// entries or attached memory
+	const Entry* table = nullptr;
+
+	static inline int typeIndex(MidiEventType t) {
+		switch (t) {
+		case MidiEventType::NOTE: return 0;
+		case MidiEventType::CONTROLCHANGE: return 1;
+		case MidiEventType::PROGCHANGE: return 2;
+		default: return -1;
+		}
+	}
+	static inline size_t index(int t, int ch, int v1, int v2) {
+		return ((static_cast<size_t>(t) * ch_count + ch) * value_count + v1) * value_count + v2;
+	}
+};
+
+#endif
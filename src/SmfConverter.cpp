@@ -0,0 +1,175 @@
+#include "SmfConverter.hpp"
+#include "LoopbackTransport.hpp"
+#include "lib/clock.hpp"
+#include <atomic>
+#include <map>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace {
+bool is_midi_file(const std::string& name) {
+	std::string s(name);
+	std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+	for (const char* ext : { ".mid", ".midi", ".smf" }) {
+		size_t n = strlen(ext);
+		if (s.size() > n && s.compare(s.size() - n, n, ext) == 0)
+			return true;
+	}
+	return false;
+}
+
+// Events are written in time order, delayed output of rules waits until
+// the file reaches its tick
+class SmfOutput {
+public:
+	explicit SmfOutput(SmfWriter& writer) :
+		writer(writer) {
+	}
+	void add(uint16_t track, uint64_t tick, const MidiEvent& ev) {
+		flush(tick);
+		writer.add(track, tick, ev);
+	}
+	void add(uint16_t track, uint64_t tick, uint8_t status, const uint8_t* data, uint32_t size) {
+		flush(tick);
+		writer.add(track, tick, status, data, size);
+	}
+	// counted notes sent by COUNT timers and delayed events since the last
+	// call, delay is converted to ticks with current tempo
+	void take(LoopbackTransport& loopback, uint16_t track, uint64_t tick, double us_per_tick) {
+		snd_seq_event_t event;
+		MidiEvent ev;
+		loopback.flush_output();
+		while (loopback.take_output(event)) {
+			if (!readMidiEvent(&event, ev))
+				continue;
+			int delay_ms = LoopbackTransport::delay_ms(event);
+			if (delay_ms == 0) {
+				add(track, tick, ev);
+				continue;
+			}
+			uint64_t delay = us_per_tick > 0 ? static_cast<uint64_t>(delay_ms * 1000.0 / us_per_tick + 0.5) : 0;
+			delayed.insert(std::make_pair(tick + delay, std::make_pair(track, ev)));
+		}
+	}
+	void flush(uint64_t tick) {
+		while (!delayed.empty() && delayed.begin()->first <= tick) {
+			writer.add(delayed.begin()->second.first, delayed.begin()->first, delayed.begin()->second.second);
+			delayed.erase(delayed.begin());
+		}
+	}
+	void flushAll() {
+		flush(~0ull);
+	}
+
+private:
+	SmfWriter& writer;
+	std::multimap<uint64_t, std::pair<uint16_t, MidiEvent>> delayed;
+};
+}
+
+size_t SmfConverter::convertFile(const std::string& inFile, const std::string& outFile) const {
+	SmfReader reader(inFile);
+	LoopbackTransport loopback(1024);
+	VirtualClock clock;
+	RuleMapper mapper(rule_file, &loopback, engine);
+	mapper.setClock(clock);
+	TimerWheel& timer = mapper.get_count_timer();
+	SmfWriter writer(reader.getFormat(), reader.getTracks(), reader.getDivision());
+	SmfOutput out(writer);
+
+	// time in microseconds at prev_tick, tempo may change at any event
+	double us_per_tick = smf_us_per_tick(reader.getDivision(), 500000);
+	double now_us = 0;
+	uint64_t prev_tick = 0;
+	uint16_t last_track = 0;
+	// fire COUNT timers that expire before time, each at its own tick
+	auto run_timers = [&](double until_us) {
+		Clock::time_point t;
+		while (timer.nextDeadline(t)) {
+			double t_us = std::chrono::duration<double, std::micro>(t.time_since_epoch()).count();
+			if (t_us > until_us)
+				break;
+			if (t > clock.now())
+				clock.advance(t - clock.now());
+			timer.advance(t);
+			uint64_t tick = prev_tick + static_cast<uint64_t>(
+				us_per_tick > 0 ? (t_us - now_us) / us_per_tick + 0.5 : 0);
+			out.take(loopback, last_track, tick, us_per_tick);
+		}
+		Clock::time_point until(std::chrono::duration_cast<Clock::duration>(
+			std::chrono::duration<double, std::micro>(until_us)));
+		if (until > clock.now())
+			clock.advance(until - clock.now());
+	};
+
+	size_t n = 0;
+	MidiEvent ev;
+	for (const SmfEvent& e : reader.events()) {
+		double us = now_us + (e.tick - prev_tick) * us_per_tick;
+		run_timers(us);
+		now_us = us;
+		prev_tick = e.tick;
+		if (e.isMeta(0x51) && e.size >= 5) {
+			// set tempo: type, length 3, microseconds per quarter note
+			us_per_tick = smf_us_per_tick(reader.getDivision(), e.data[2] << 16 | e.data[3] << 8 | e.data[4]);
+		}
+		if (e.isMeta(0x2F))
+			continue; // end of track is written after all events
+		if (!e.toMidiEvent(ev)) {
+			out.add(e.track, e.tick, e.status, e.data, e.size);
+			continue;
+		}
+		last_track = e.track;
+		if (mapper.applyRules(ev))
+			out.add(e.track, e.tick, ev);
+		out.take(loopback, e.track, e.tick, us_per_tick);
+		n++;
+	}
+	// counted notes of the last series
+	run_timers(now_us + 10000000);
+	out.flushAll();
+	writer.save(outFile);
+	LOG(LogLvl::INFO) << "Converted MIDI file: " << inFile << " to: " << outFile << ", events: " << n;
+	return n;
+}
+
+size_t SmfConverter::convertDirectory(const std::string& inDir, const std::string& outDir, unsigned int threads) const {
+	std::vector<std::string> names;
+	DIR* dir = opendir(inDir.c_str());
+	if (dir == nullptr)
+		throw std::runtime_error("Cannot open directory: " + inDir);
+	while (dirent* d = readdir(dir)) {
+		if (is_midi_file(d->d_name))
+			names.push_back(d->d_name);
+	}
+	closedir(dir);
+	std::sort(names.begin(), names.end());
+	if (mkdir(outDir.c_str(), 0755) < 0 && errno != EEXIST)
+		throw std::runtime_error("Cannot create directory: " + outDir);
+
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::min<size_t>(threads, std::max<size_t>(names.size(), 1));
+	std::atomic<size_t> next { 0 }, converted { 0 }, events { 0 };
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> pool;
+	for (unsigned int i = 0; i < threads; i++) {
+		pool.push_back(std::thread([&]() {
+			for (size_t k = next++; k < names.size(); k = next++) {
+				try {
+					events += convertFile(inDir + "/" + names[k], outDir + "/" + names[k]);
+					converted++;
+				}
+				catch (std::exception& e) {
+					LOG(LogLvl::ERROR) << "Failed to convert: " << names[k] << ", error: " << e.what();
+				}
+			}
+			}));
+	}
+	for (std::thread& t : pool)
+		t.join();
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	LOG(LogLvl::INFO) << "Converted MIDI files: " << converted << " of " << names.size() << ", events: "
+		<< events << ", threads: " << threads << ", events per second: " << (sec > 0 ? events / sec : 0);
+	return converted;
+}
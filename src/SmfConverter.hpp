@@ -0,0 +1,29 @@
+#ifndef SMFCONVERTER_H
+#define SMFCONVERTER_H
+
+#include "pch.hpp"
+#include "RuleMapper.hpp"
+#include "SmfFile.hpp"
+
+// Converts MIDI files offline with the same rules as live converter. Note,
+// CC and program change events go through rules, other events are copied.
+// COUNT rules use time of the file, counted notes go to the track of the
+// last counted event.
+class SmfConverter {
+public:
+	SmfConverter(const std::string& ruleFile, RuleEngine eng = RuleEngine::TABLE) :
+		rule_file(ruleFile), engine(eng) {
+	}
+
+	// returns number of events that went through rules
+	size_t convertFile(const std::string& inFile, const std::string& outFile) const;
+	// converts *.mid files of directory on a pool of threads, returns number of
+	// converted files
+	size_t convertDirectory(const std::string& inDir, const std::string& outDir, unsigned int threads) const;
+
+private:
+	const std::string rule_file;
+	const RuleEngine engine;
+};
+
+#endif
@@ -0,0 +1,223 @@
+#include "SmfFile.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+inline uint32_t read_be(const uint8_t* p, int n) {
+	uint32_t v = 0;
+	for (int i = 0; i < n; i++)
+		v = v << 8 | p[i];
+	return v;
+}
+
+// variable length quantity, throws if it goes past end
+uint32_t read_vlq(const uint8_t* p, size_t end, size_t& pos) {
+	uint32_t v = 0;
+	for (int i = 0; i < 4; i++) {
+		if (pos >= end)
+			throw MidiAppError("Bad MIDI file: truncated variable length value", true);
+		uint8_t b = p[pos++];
+		v = v << 7 | (b & 0x7F);
+		if ((b & 0x80) == 0)
+			return v;
+	}
+	throw MidiAppError("Bad MIDI file: variable length value is too long", true);
+}
+
+void write_vlq(std::vector<uint8_t>& out, uint32_t v) {
+	uint8_t tmp[5];
+	int n = 0;
+	tmp[n++] = v & 0x7F;
+	while ((v >>= 7) > 0)
+		tmp[n++] = 0x80 | (v & 0x7F);
+	while (n > 0)
+		out.push_back(tmp[--n]);
+}
+
+void write_be(std::vector<uint8_t>& out, uint32_t v, int n) {
+	for (int i = n - 1; i >= 0; i--)
+		out.push_back((v >> (8 * i)) & 0xFF);
+}
+}
+
+double smf_us_per_tick(uint16_t division, uint32_t tempo) {
+	if (division & 0x8000) {
+		// SMPTE frames per second and ticks per frame, tempo is not used
+		int fps = -static_cast<int8_t>(division >> 8);
+		int tpf = division & 0xFF;
+		return fps * tpf == 0 ? 0 : 1000000.0 / (fps * tpf);
+	}
+	return division == 0 ? 0 : static_cast<double>(tempo) / division;
+}
+
+bool SmfEvent::toMidiEvent(MidiEvent& ev) const {
+	ev.ch = status & 0x0F;
+	switch (status & 0xF0) {
+	case 0x80:
+		ev.evtype = MidiEventType::NOTE;
+		ev.v1 = data[0];
+		ev.v2 = 0;
+		return true;
+	case 0x90:
+		ev.evtype = MidiEventType::NOTE;
+		ev.v1 = data[0];
+		ev.v2 = data[1];
+		return true;
+	case 0xB0:
+		ev.evtype = MidiEventType::CONTROLCHANGE;
+		ev.v1 = data[0];
+		ev.v2 = data[1];
+		return true;
+	case 0xC0:
+		ev.evtype = MidiEventType::PROGCHANGE;
+		ev.v1 = data[0];
+		ev.v2 = 0;
+		return true;
+	}
+	return false;
+}
+
+SmfReader::SmfReader(const std::string& fileName) {
+	int fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		throw std::runtime_error("Cannot open MIDI file: " + fileName);
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < 14) {
+		::close(fd);
+		throw MidiAppError("Not a MIDI file: " + fileName, true);
+	}
+	size = st.st_size;
+	void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED)
+		throw std::runtime_error("Cannot map MIDI file: " + fileName);
+	data = static_cast<const uint8_t*>(p);
+
+	try {
+		if (memcmp(data, "MThd", 4) != 0 || read_be(data + 4, 4) < 6)
+			throw MidiAppError("Not a MIDI file: " + fileName, true);
+		format = read_be(data + 8, 2);
+		tracks = read_be(data + 10, 2);
+		division = read_be(data + 12, 2);
+		if (format > 1)
+			throw MidiAppError("MIDI file format " + std::to_string(format) + " is not supported: " + fileName, true);
+		// chunks of unknown type are skipped
+		size_t pos = 8 + read_be(data + 4, 4);
+		while (pos + 8 <= size && static_cast<int>(track_chunks.size()) < tracks) {
+			size_t len = read_be(data + pos + 4, 4);
+			if (pos + 8 + len > size)
+				throw MidiAppError("Bad MIDI file: truncated track in " + fileName, true);
+			if (memcmp(data + pos, "MTrk", 4) == 0)
+				track_chunks.push_back(std::make_pair(pos + 8, len));
+			pos += 8 + len;
+		}
+		tracks = track_chunks.size();
+	}
+	catch (...) {
+		munmap(p, size);
+		throw;
+	}
+}
+
+SmfReader::~SmfReader() {
+	munmap(const_cast<uint8_t*>(data), size);
+}
+
+void SmfReader::readTrack(uint16_t track, std::vector<SmfEvent>& out) const {
+	size_t pos = track_chunks[track].first;
+	const size_t end = pos + track_chunks[track].second;
+	uint64_t tick = 0;
+	uint8_t running = 0;
+	while (pos < end) {
+		SmfEvent e;
+		tick += read_vlq(data, end, pos);
+		e.tick = tick;
+		e.track = track;
+		if (pos >= end)
+			throw MidiAppError("Bad MIDI file: event without status", true);
+		if (data[pos] & 0x80)
+			e.status = data[pos++];
+		else if (running != 0)
+			e.status = running;
+		else
+			throw MidiAppError("Bad MIDI file: running status without status", true);
+		e.data = data + pos;
+		if (e.status == 0xFF) {
+			pos++; // meta type
+			pos += read_vlq(data, end, pos);
+			running = 0;
+		}
+		else if (e.status == 0xF0 || e.status == 0xF7) {
+			pos += read_vlq(data, end, pos);
+			running = 0;
+		}
+		else if (e.status >= 0xF0) {
+			throw MidiAppError("Bad MIDI file: unexpected system message", true);
+		}
+		else {
+			const uint8_t type = e.status & 0xF0;
+			pos += (type == 0xC0 || type == 0xD0) ? 1 : 2;
+			running = e.status;
+		}
+		if (pos > end)
+			throw MidiAppError("Bad MIDI file: truncated event", true);
+		e.size = data + pos - e.data;
+		out.push_back(e);
+	}
+}
+
+std::vector<SmfEvent> SmfReader::events() const {
+	std::vector<SmfEvent> all;
+	for (int t = 0; t < tracks; t++)
+		readTrack(t, all);
+	// tracks are appended one after another, stable sort keeps their order
+	std::stable_sort(all.begin(), all.end(), [](const SmfEvent& a, const SmfEvent& b) {
+		return a.tick < b.tick;
+		});
+	return all;
+}
+
+SmfWriter::SmfWriter(int format, int n_tracks, uint16_t division) :
+	format(format), division(division), tracks(n_tracks) {
+}
+
+void SmfWriter::add(uint16_t track, uint64_t tick, uint8_t status, const uint8_t* data, uint32_t size) {
+	Track& t = tracks[track];
+	write_vlq(t.bytes, tick > t.last_tick ? tick - t.last_tick : 0);
+	t.last_tick = std::max(t.last_tick, tick);
+	t.bytes.push_back(status);
+	t.bytes.insert(t.bytes.end(), data, data + size);
+}
+
+void SmfWriter::add(uint16_t track, uint64_t tick, const MidiEvent& ev) {
+	uint8_t d[2] = { ev.v1, ev.v2 };
+	if (ev.isNote())
+		add(track, tick, 0x90 | (ev.ch & 0x0F), d, 2);
+	else if (ev.isCc())
+		add(track, tick, 0xB0 | (ev.ch & 0x0F), d, 2);
+	else if (ev.isPc())
+		add(track, tick, 0xC0 | (ev.ch & 0x0F), d, 1);
+}
+
+void SmfWriter::save(const std::string& fileName) const {
+	std::vector<uint8_t> out;
+	out.insert(out.end(), { 'M', 'T', 'h', 'd' });
+	write_be(out, 6, 4);
+	write_be(out, format, 2);
+	write_be(out, tracks.size(), 2);
+	write_be(out, division, 2);
+	const uint8_t end_of_track[] = { 0x00, 0xFF, 0x2F, 0x00 };
+	for (const Track& t : tracks) {
+		out.insert(out.end(), { 'M', 'T', 'r', 'k' });
+		write_be(out, t.bytes.size() + sizeof(end_of_track), 4);
+		out.insert(out.end(), t.bytes.begin(), t.bytes.end());
+		out.insert(out.end(), end_of_track, end_of_track + sizeof(end_of_track));
+	}
+	std::ofstream f(fileName, std::ios::binary | std::ios::trunc);
+	f.write(reinterpret_cast<const char*>(out.data()), out.size());
+	if (!f)
+		throw std::runtime_error("Cannot write MIDI file: " + fileName);
+}
@@ -0,0 +1,77 @@
+#ifndef SMFFILE_H
+#define SMFFILE_H
+
+#include "pch.hpp"
+#include "MidiEvent.hpp"
+#include <cstdint>
+
+// Event of Standard MIDI File. Bytes after status point into the mapped
+// file: data bytes of channel event, type, length and payload of meta
+// event, length and payload of system exclusive event.
+struct SmfEvent {
+	uint64_t tick = 0; // time from start of track
+	const uint8_t* data = nullptr;
+	uint32_t size = 0;
+	uint16_t track = 0;
+	uint8_t status = 0;
+
+	bool isMeta(uint8_t type) const {
+		return status == 0xFF && size > 0 && data[0] == type;
+	}
+	// note, CC and program change as MidiEvent, false for other events
+	bool toMidiEvent(MidiEvent& ev) const;
+};
+
+// Reads MIDI file format 0 or 1 mapped to memory, nothing is copied.
+class SmfReader {
+public:
+	explicit SmfReader(const std::string& fileName);
+	virtual ~SmfReader();
+
+	int getFormat() const {
+		return format;
+	}
+	int getTracks() const {
+		return tracks;
+	}
+	uint16_t getDivision() const {
+		return division;
+	}
+	// events of all tracks in time order, at the same time in order of tracks
+	std::vector<SmfEvent> events() const;
+
+private:
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+	int format = 0;
+	int tracks = 0;
+	uint16_t division = 0;
+	std::vector<std::pair<size_t, size_t>> track_chunks; // offset and length
+
+	void readTrack(uint16_t track, std::vector<SmfEvent>& out) const;
+};
+
+// Builds MIDI file, events of each track are added in time order.
+class SmfWriter {
+public:
+	SmfWriter(int format, int tracks, uint16_t division);
+
+	void add(uint16_t track, uint64_t tick, uint8_t status, const uint8_t* data, uint32_t size);
+	void add(uint16_t track, uint64_t tick, const MidiEvent& ev);
+	// appends end of track to every track and writes file
+	void save(const std::string& fileName) const;
+
+private:
+	struct Track {
+		std::vector<uint8_t> bytes;
+		uint64_t last_tick = 0;
+	};
+	const int format;
+	const uint16_t division;
+	std::vector<Track> tracks;
+};
+
+// microseconds per tick for tempo in microseconds per quarter note
+double smf_us_per_tick(uint16_t division, uint32_t tempo);
+
+#endif
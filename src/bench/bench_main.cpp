@@ -0,0 +1,341 @@
+#include "pch.hpp"
+#include "MidiEvent.hpp"
+#include "RuleMapper.hpp"
+#include "MidiConverter.hpp"
+#include "LoopbackTransport.hpp"
+#include "RuleCache.hpp"
+#include "lib/clock.hpp"
+#include "lib/utils.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+// Benchmarks of rule parsing, event conversion and rule engines.
+// Build: make bench, run: ./bench [rules.txt] > bench.json
+// Rule corpora and event traces are generated with fixed seeds so results
+// of different machines (e.g. Raspberry Pi and x86) can be compared.
+
+namespace {
+std::atomic<unsigned long> alloc_count { 0 };
+}
+
+void* operator new(std::size_t n) {
+	alloc_count.fetch_add(1, std::memory_order_relaxed);
+	void* p = std::malloc(n == 0 ? 1 : n);
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+// not inlined, so compiler does not pair free() with operator new
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+namespace {
+const int rounds = 5;
+const size_t trace_size = 100000;
+
+struct Result {
+	std::string name, corpus, engine;
+	size_t rules;
+	size_t items; // events, rules or matches done in one round
+	double ns_per_item;
+	double allocs_per_item;
+};
+
+// best time of several rounds, allocations are averaged
+template<typename F>
+Result measure(const std::string& name, size_t items, F f) {
+	Result r;
+	r.name = name;
+	r.rules = 0;
+	r.items = items;
+	double best = 0;
+	unsigned long allocs = alloc_count.load();
+	for (int i = 0; i < rounds; i++) {
+		auto start = std::chrono::steady_clock::now();
+		f();
+		double ns = std::chrono::duration<double, std::nano>(
+			std::chrono::steady_clock::now() - start).count();
+		if (i == 0 || ns < best)
+			best = ns;
+	}
+	r.ns_per_item = best / items;
+	r.allocs_per_item = static_cast<double>(alloc_count.load() - allocs) / rounds / items;
+	return r;
+}
+
+inline unsigned int next_random(unsigned int& seed) {
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+// conversion rules of all types ending with pass all rule, so every event
+// goes through the list
+std::vector<std::string> generate_rules(size_t n) {
+	std::vector<std::string> lines;
+	for (size_t k = 0; k + 1 < n; k++) {
+		int ch = (k / 128) % 16, v = k % 128;
+		std::ostringstream ss;
+		switch (k % 4) {
+		case 0:
+			ss << "n," << ch << "," << v << ",=c,,,=s";
+			break;
+		case 1:
+			ss << "c," << ch << "," << v << ",=n,,,100=p";
+			break;
+		case 2:
+			ss << "n," << ch << "," << v << ",1:127=n,,,64=p";
+			break;
+		default:
+			ss << "p," << ch << "," << v << ",=p," << (ch + 1) % 16 << ",,=s";
+		}
+		lines.push_back(ss.str());
+	}
+	lines.push_back("a,,,=a,,,=p");
+	return lines;
+}
+
+void add_rules(RuleMapper& mapper, const std::vector<std::string>& lines) {
+	for (const std::string& s : lines) {
+		try {
+			mapper.parseString(s);
+		}
+		catch (std::exception&) {
+		}
+	}
+	mapper.compile();
+}
+
+std::vector<std::string> read_rules(const std::string& fileName) {
+	std::vector<std::string> lines;
+	std::ifstream f(fileName);
+	std::string s;
+	while (getline(f, s)) {
+		remove_spaces(s);
+		if (!s.empty())
+			lines.push_back(s);
+	}
+	return lines;
+}
+
+// notes, CC and program changes, half of them on channel 0 used by rules.txt
+std::vector<MidiEvent> generate_trace(size_t n) {
+	std::vector<MidiEvent> events(n);
+	unsigned int seed = 1;
+	for (MidiEvent& ev : events) {
+		unsigned int r = next_random(seed);
+		int kind = r % 20;
+		ev.evtype = kind < 10 ? MidiEventType::NOTE
+			: (kind < 17 ? MidiEventType::CONTROLCHANGE : MidiEventType::PROGCHANGE);
+		r = next_random(seed);
+		ev.ch = (r & 1) ? 0 : (r >> 1) % 16;
+		ev.v1 = (r >> 5) % 128;
+		ev.v2 = ev.isPc() ? 0 : (r >> 12) % 128;
+	}
+	return events;
+}
+
+std::string json_string(const std::string& s) {
+	std::string out = "\"";
+	for (char c : s) {
+		if (c == '"' || c == '\\')
+			out += '\\';
+		out += c;
+	}
+	return out + "\"";
+}
+
+void print_json(const std::vector<Result>& results) {
+	cout << "{\n  \"host\": {\"isa\": " << json_string(RuleMatcher::instructionSet())
+		<< ", \"compiler\": " << json_string(__VERSION__)
+		<< ", \"pointer_bits\": " << sizeof(void*) * 8
+		<< ", \"rounds\": " << rounds << "},\n  \"results\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result& r = results[i];
+		cout << "    {\"name\": " << json_string(r.name)
+			<< ", \"corpus\": " << json_string(r.corpus)
+			<< ", \"engine\": " << json_string(r.engine)
+			<< ", \"rules\": " << r.rules
+			<< ", \"items\": " << r.items
+			<< ", \"ns_per_item\": " << r.ns_per_item
+			<< ", \"items_per_sec\": " << (r.ns_per_item > 0 ? 1e9 / r.ns_per_item : 0)
+			<< ", \"allocs_per_item\": " << r.allocs_per_item << "}"
+			<< (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	cout << "  ]\n}" << std::endl;
+}
+}
+
+int main(int argc, char* argv[]) {
+	const std::string ruleFile = argc > 1 ? argv[1] : "rules.txt";
+	LOG::ReportingLevel() = LogLvl::ERROR;
+
+	std::vector<std::pair<std::string, std::vector<std::string>>> corpora;
+	corpora.push_back(std::make_pair(ruleFile, read_rules(ruleFile)));
+	if (corpora[0].second.empty()) {
+		std::cerr << "No rules in " << ruleFile << ", it is skipped" << std::endl;
+		corpora.clear();
+	}
+	for (size_t n : { 100, 1000, 10000 })
+		corpora.push_back(std::make_pair("generated_" + std::to_string(n), generate_rules(n)));
+
+	const std::vector<MidiEvent> trace = generate_trace(trace_size);
+	std::vector<snd_seq_event_t> alsa_trace(trace.size());
+	for (size_t i = 0; i < trace.size(); i++) {
+		snd_seq_ev_clear(&alsa_trace[i]);
+		writeMidiEvent(&alsa_trace[i], trace[i]);
+	}
+
+	std::vector<Result> results;
+	volatile long sink = 0;
+
+	results.push_back(measure("write_event", trace.size(), [&]() {
+		snd_seq_event_t event;
+		for (const MidiEvent& ev : trace) {
+			snd_seq_ev_clear(&event);
+			sink += writeMidiEvent(&event, ev);
+		}
+	}));
+	results.push_back(measure("read_event", alsa_trace.size(), [&]() {
+		MidiEvent ev;
+		for (const snd_seq_event_t& event : alsa_trace)
+			sink += readMidiEvent(&event, ev);
+	}));
+
+	// double taps counted on virtual time: COUNT rule and timer wheel cost
+	VirtualClock clock;
+	RuleMapper counter("", nullptr);
+	add_rules(counter, std::vector<std::string> { "n,0,60,=c" });
+	counter.setClock(clock);
+	const int taps = 10000;
+	const MidiEvent note_on("n,0,60,100"), note_off("n,0,60,0");
+	results.push_back(measure("count_tap", 4 * taps, [&]() {
+		MidiEvent ev;
+		for (int i = 0; i < 4 * taps; i++) {
+			ev = i % 2 ? note_off : note_on;
+			sink += counter.applyRules(ev);
+			clock.advance_ms(i % 4 == 3 ? 1000 : 100);
+			counter.get_count_timer().advance(clock.now());
+		}
+	}));
+
+	for (const auto& corpus : corpora) {
+		const std::vector<std::string>& lines = corpus.second;
+		Result r = measure("parse_rule", lines.size(), [&]() {
+			for (const std::string& s : lines) {
+				try {
+					MidiEventRule rule(s);
+					sink += static_cast<long>(rule.ruleType);
+				}
+				catch (std::exception&) {
+				}
+			}
+		});
+		r.corpus = corpus.first;
+		r.rules = lines.size();
+		results.push_back(r);
+
+		// startup: whole rule file read and parsed
+		const std::string tmp_file = "/tmp/mimap_bench.rules";
+		{
+			std::ofstream f(tmp_file);
+			for (const std::string& s : lines)
+				f << s << "\n";
+		}
+		r = measure("read_file", lines.size(), [&]() {
+			RuleSet rs(RuleEngine::SCAN);
+			sink += rs.readFile(tmp_file) + rs.rules.size();
+		});
+		r.corpus = corpus.first;
+		r.rules = lines.size();
+		results.push_back(r);
+
+		// startup with compiled rules and table mapped from rule cache
+		RuleSet(RuleEngine::TABLE).load(tmp_file);
+		r = measure("load_cache", lines.size(), [&]() {
+			RuleSet rs(RuleEngine::TABLE);
+			sink += rs.load(tmp_file) + rs.rules.size();
+		});
+		std::remove(tmp_file.c_str());
+		std::remove(rule_cache_name(tmp_file).c_str());
+		r.corpus = corpus.first;
+		r.engine = "table";
+		r.rules = lines.size();
+		results.push_back(r);
+
+		RuleMapper mapper("", nullptr, RuleEngine::SCAN);
+		add_rules(mapper, lines);
+		// range match of every event with every rule, as done by scan engine
+		const size_t n_events = std::min(trace.size(), 1000000 / (mapper.getSize() + 1) + 1);
+		r = measure("range_match", n_events * mapper.getSize(), [&]() {
+			for (size_t i = 0; i < n_events; i++)
+				for (size_t k = 0; k < mapper.getSize(); k++)
+					sink += mapper.getRule(k).inEventRange.match(trace[i]);
+		});
+		r.corpus = corpus.first;
+		r.rules = mapper.getSize();
+		results.push_back(r);
+
+		for (const char* engine : { "scan", "index", "simd", "table" }) {
+			mapper.setEngine(RuleMapper::engineFromString(engine));
+			mapper.compile();
+			// scan of long lists is slow, use part of the trace
+			const size_t n_apply = mapper.getEngine() == RuleEngine::SCAN ? n_events : trace.size();
+			r = measure("apply_rules", n_apply, [&]() {
+				for (size_t i = 0; i < n_apply; i++) {
+					MidiEvent e = trace[i];
+					sink += mapper.applyRules(e);
+				}
+			});
+			r.corpus = corpus.first;
+			r.engine = engine;
+			r.rules = mapper.getSize();
+			results.push_back(r);
+		}
+
+		// code generated from BENCH_RULES file, used only for the same file
+		if (corpus.first == ruleFile && generated_rules() != nullptr) {
+			RuleMapper gen_mapper(ruleFile, nullptr, RuleEngine::GENERATED);
+			if (gen_mapper.getEngine() == RuleEngine::GENERATED) {
+				r = measure("apply_rules", trace.size(), [&]() {
+					for (const MidiEvent& ev : trace) {
+						MidiEvent e = ev;
+						sink += gen_mapper.applyRules(e);
+					}
+				});
+				r.corpus = corpus.first;
+				r.engine = "generated";
+				r.rules = gen_mapper.getSize();
+				results.push_back(r);
+			}
+		}
+
+		// converter with in memory transport: input batches, rules, output
+		LoopbackTransport loopback(1024);
+		RuleMapper loop_mapper("", &loopback);
+		add_rules(loop_mapper, lines);
+		MidiConverter converter(&loop_mapper);
+		loopback.set_nonblock(true);
+		r = measure("convert_loopback", alsa_trace.size(), [&]() {
+			MidiEvent ev;
+			snd_seq_event_t out;
+			for (size_t i = 0; i < alsa_trace.size(); i += 256) {
+				for (size_t k = i; k < i + 256 && k < alsa_trace.size(); k++)
+					loopback.inject(alsa_trace[k]);
+				converter.process_batch(ev);
+				while (loopback.take_output(out))
+					sink += out.type;
+			}
+		});
+		r.corpus = corpus.first;
+		r.engine = "table";
+		r.rules = loop_mapper.getSize();
+		results.push_back(r);
+	}
+	print_json(results);
+	return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Source of time for timers and rules that depend on time. Time points are
+// of steady_clock, so real and virtual time can be used with the same code.
+class Clock {
+public:
+	typedef std::chrono::steady_clock::time_point time_point;
+	typedef std::chrono::steady_clock::duration duration;
+
+	virtual ~Clock() {
+	}
+	virtual time_point now() const = 0;
+	// virtual time moves only when it is advanced, nothing waits for it
+	virtual bool isVirtual() const {
+		return false;
+	}
+	// steady_clock shared by everyone who does not set own clock
+	static const Clock& system();
+};
+
+class SteadyClock : public Clock {
+public:
+	time_point now() const override {
+		return std::chrono::steady_clock::now();
+	}
+};
+
+// Simulated time for tests, replay and benchmarks, it starts at zero time
+// point and moves only by advance().
+class VirtualClock : public Clock {
+public:
+	time_point now() const override {
+		return time_point(duration(ticks.load(std::memory_order_acquire)));
+	}
+	bool isVirtual() const override {
+		return true;
+	}
+	void advance(duration d) {
+		ticks.fetch_add(d.count(), std::memory_order_acq_rel);
+	}
+	void advance_ms(int ms) {
+		advance(std::chrono::milliseconds(ms));
+	}
+
+private:
+	std::atomic<duration::rep> ticks { 0 };
+};
+
+inline const Clock& Clock::system() {
+	static const SteadyClock steady;
+	return steady;
+}
+
+#endif
@@ -0,0 +1,66 @@
+#include "file_watch.hpp"
+#include "log.hpp"
+#include <cstring>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+FileWatcher::FileWatcher(const std::string& path, std::function<void()> handler, int settle_ms) :
+	handler(handler), settle_ms(settle_ms) {
+	size_t slash = path.rfind('/');
+	const std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+	name = slash == std::string::npos ? path : path.substr(slash + 1);
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+		throw std::runtime_error("Error creating inotify");
+	if (inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+		close(fd);
+		throw std::runtime_error("Cannot watch directory: " + dir);
+	}
+	worker = std::thread(&FileWatcher::run, this);
+}
+
+FileWatcher::~FileWatcher() {
+	stopping = true;
+	if (worker.joinable())
+		worker.join();
+	close(fd);
+}
+
+bool FileWatcher::waitChange(int timeout_ms) {
+	// true if there was event for the watched file
+	pollfd p = { fd, POLLIN, 0 };
+	if (poll(&p, 1, timeout_ms) <= 0)
+		return false;
+	alignas(inotify_event) char buf[4096];
+	bool changed = false;
+	ssize_t n;
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		for (char* p = buf; p < buf + n; ) {
+			const inotify_event* ev = reinterpret_cast<const inotify_event*>(p);
+			if (ev->len > 0 && name == ev->name)
+				changed = true;
+			p += sizeof(inotify_event) + ev->len;
+		}
+	}
+	return changed;
+}
+
+void FileWatcher::run() {
+	while (!stopping) {
+		if (!waitChange(200))
+			continue;
+		// editor may write file in several steps, wait until it is quiet
+		while (!stopping && waitChange(settle_ms)) {
+		}
+		if (stopping)
+			break;
+		try {
+			handler();
+		}
+		catch (std::exception& e) {
+			LOG(LogLvl::ERROR) << "File change handler failed: " << e.what();
+		}
+	}
+}
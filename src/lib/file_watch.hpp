@@ -0,0 +1,29 @@
+#ifndef FILE_WATCH_H
+#define FILE_WATCH_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+// Calls handler on own thread when file is written or replaced. Directory
+// of the file is watched with inotify, so editors that save a new file and
+// rename it over the old one are noticed too.
+class FileWatcher {
+public:
+	FileWatcher(const std::string& path, std::function<void()> handler, int settle_ms = 100);
+	virtual ~FileWatcher();
+
+private:
+	const std::function<void()> handler;
+	const int settle_ms;
+	std::string name;
+	int fd = -1;
+	std::atomic<bool> stopping { false };
+	std::thread worker;
+
+	void run();
+	bool waitChange(int timeout_ms);
+};
+
+#endif
@@ -0,0 +1,35 @@
+#include "histogram.hpp"
+#include <algorithm>
+#include <sstream>
+
+void LatencyHistogram::reset() {
+	for (int i = 0; i < bucket_count; i++)
+		counts[i].store(0, std::memory_order_relaxed);
+	total.store(0, std::memory_order_relaxed);
+	max_value.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+	const uint64_t n = count();
+	if (n == 0)
+		return 0;
+	uint64_t rank = static_cast<uint64_t>(p / 100.0 * n + 0.5);
+	if (rank < 1)
+		rank = 1;
+	uint64_t seen = 0;
+	for (int i = 0; i < bucket_count; i++) {
+		seen += counts[i].load(std::memory_order_relaxed);
+		if (seen >= rank)
+			return std::min(bucketUpper(i), max());
+	}
+	return max();
+}
+
+std::string LatencyHistogram::toString() const {
+	std::ostringstream ss;
+	ss.precision(1);
+	ss << std::fixed << "count: " << count() << ", p50: " << percentile(50) / 1000.0
+		<< " us, p99: " << percentile(99) / 1000.0 << " us, p99.9: " << percentile(99.9) / 1000.0
+		<< " us, max: " << max() / 1000.0 << " us";
+	return ss.str();
+}
@@ -0,0 +1,63 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Log-linear histogram of values in nanoseconds. Each power of two range
+// is split into 2^sub_bits linear buckets, so a bucket is less than 1/8 of
+// its value wide. record() is lock free and may be called from any thread.
+class LatencyHistogram {
+public:
+	static const int sub_bits = 3;
+	static const int max_bits = 40; // about 18 minutes
+	static const int bucket_count = (max_bits - sub_bits + 1) << sub_bits;
+
+	LatencyHistogram() {
+		reset();
+	}
+	void record(uint64_t ns) {
+		counts[bucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+		total.fetch_add(1, std::memory_order_relaxed);
+		uint64_t m = max_value.load(std::memory_order_relaxed);
+		while (ns > m && !max_value.compare_exchange_weak(m, ns, std::memory_order_relaxed)) {
+		}
+	}
+	void reset();
+	uint64_t count() const {
+		return total.load(std::memory_order_relaxed);
+	}
+	uint64_t max() const {
+		return max_value.load(std::memory_order_relaxed);
+	}
+	// upper bound of the bucket with the value at percentile p (0 .. 100)
+	uint64_t percentile(double p) const;
+	// count, p50, p99, p99.9 and max in microseconds
+	std::string toString() const;
+
+	static int bucketIndex(uint64_t v) {
+		if (v < (1u << sub_bits))
+			return static_cast<int>(v);
+		int msb = 63 - __builtin_clzll(v);
+		if (msb >= max_bits)
+			return bucket_count - 1;
+		int shift = msb - sub_bits;
+		int sub = static_cast<int>(v >> shift) - (1 << sub_bits);
+		return ((shift + 1) << sub_bits) + sub;
+	}
+	static uint64_t bucketUpper(int i) {
+		int group = i >> sub_bits;
+		uint64_t sub = i & ((1 << sub_bits) - 1);
+		if (group == 0)
+			return sub;
+		return (((1u << sub_bits) + sub + 1) << (group - 1)) - 1;
+	}
+
+private:
+	std::atomic<uint64_t> counts[bucket_count];
+	std::atomic<uint64_t> total;
+	std::atomic<uint64_t> max_value;
+};
+
+#endif
@@ -0,0 +1,182 @@
+#include "log.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+namespace {
+const size_t line_size = 256;
+const size_t ring_lines = 256;
+const char* const level_names[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+struct LogLine {
+	unsigned short len;
+	char text[line_size - sizeof(unsigned short)];
+};
+
+// lines of one thread, written by that thread and read by the writer thread
+struct LogRing {
+	LogLine lines[ring_lines];
+	std::atomic<size_t> head { 0 };
+	std::atomic<size_t> tail { 0 };
+	std::atomic<bool> alive { true };
+};
+
+// formats into fixed buffer, text that does not fit is cut
+class LineBuf : public std::streambuf {
+public:
+	LineBuf() {
+		reset();
+	}
+	void reset() {
+		setp(text, text + sizeof(text));
+	}
+	const char* data() const {
+		return pbase();
+	}
+	size_t size() const {
+		return pptr() - pbase();
+	}
+protected:
+	int_type overflow(int_type ch) override {
+		return traits_type::not_eof(ch);
+	}
+private:
+	char text[sizeof(LogLine::text)];
+};
+
+class LogWriter {
+public:
+	// never destroyed, other threads may log while the process exits
+	static LogWriter& instance() {
+		static LogWriter* writer = create();
+		return *writer;
+	}
+
+	std::shared_ptr<LogRing> attach() {
+		std::shared_ptr<LogRing> ring(new LogRing());
+		std::lock_guard<std::mutex> lock(mtx);
+		rings.push_back(ring);
+		if (!worker.joinable())
+			worker = std::thread(&LogWriter::run, this);
+		return ring;
+	}
+
+	// background writer does not drain while held, forced drain always does
+	void drain(bool forced, bool write = true) {
+		std::lock_guard<std::mutex> lock(drain_mtx);
+		if (!forced && held.load())
+			return;
+		std::vector<std::shared_ptr<LogRing>> copy;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			copy = rings;
+		}
+		bool written = false;
+		for (const std::shared_ptr<LogRing>& r : copy) {
+			const size_t h = r->head.load(std::memory_order_acquire);
+			size_t t = write ? r->tail.load(std::memory_order_relaxed) : h;
+			for (; t != h; t++) {
+				const LogLine& line = r->lines[t % ring_lines];
+				fwrite(line.text, 1, line.len, stdout);
+				fputc('\n', stdout);
+				written = true;
+			}
+			r->tail.store(t, std::memory_order_release);
+		}
+		if (written)
+			fflush(stdout);
+		// rings of finished threads are removed when empty
+		std::lock_guard<std::mutex> lock2(mtx);
+		for (size_t i = rings.size(); i-- > 0;) {
+			const LogRing& r = *rings[i];
+			if (!r.alive.load() && r.head.load() == r.tail.load())
+				rings.erase(rings.begin() + i);
+		}
+	}
+
+	std::atomic<unsigned long> dropped { 0 };
+	std::atomic<bool> held { false };
+
+private:
+	std::mutex mtx; // guards list of rings
+	std::mutex drain_mtx; // one drain at a time
+	std::vector<std::shared_ptr<LogRing>> rings;
+	std::thread worker;
+
+	static LogWriter* create() {
+		std::atexit(Log::Flush);
+		return new LogWriter();
+	}
+	void run() {
+		while (true) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			drain(false);
+		}
+	}
+};
+
+struct ThreadLog {
+	LineBuf buf;
+	std::ostream os;
+	std::shared_ptr<LogRing> ring;
+	ThreadLog() : os(&buf), ring(LogWriter::instance().attach()) {
+	}
+	~ThreadLog() {
+		ring->alive.store(false);
+	}
+};
+
+ThreadLog& thread_log() {
+	thread_local ThreadLog t;
+	return t;
+}
+}
+
+std::ostream& Log::Get(LogLvl level) {
+	ThreadLog& t = thread_log();
+	t.buf.reset();
+	t.os.clear();
+	t.os << level_names[(int) level] << ": ";
+	return t.os;
+}
+
+Log::~Log() {
+	ThreadLog& t = thread_log();
+	LogRing& r = *t.ring;
+	const size_t h = r.head.load(std::memory_order_relaxed);
+	if (h - r.tail.load(std::memory_order_acquire) >= ring_lines) {
+		LogWriter::instance().dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	LogLine& line = r.lines[h % ring_lines];
+	line.len = static_cast<unsigned short>(t.buf.size());
+	memcpy(line.text, t.buf.data(), line.len);
+	r.head.store(h + 1, std::memory_order_release);
+}
+
+void Log::Flush() {
+	LogWriter::instance().drain(true);
+}
+
+void Log::HoldWriter(bool on) {
+	LogWriter::instance().held.store(on);
+}
+
+void Log::Discard() {
+	LogWriter::instance().drain(true, false);
+}
+
+size_t Log::RingLines() {
+	return ring_lines;
+}
+
+unsigned long Log::Dropped() {
+	return LogWriter::instance().dropped.load(std::memory_order_relaxed);
+}
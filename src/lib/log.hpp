@@ -1,14 +1,24 @@
 #ifndef __LOG1_H__
 #define __LOG1_H__
 
+#include <cstddef>
 #include <iostream>
 
 using std::cout;
 
+// Levels below LOG_MIN_LEVEL are removed at compile time,
+// e.g. -DLOG_MIN_LEVEL=2 keeps only WARN and ERROR
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
 enum class LogLvl {
 	DEBUG, INFO, WARN, ERROR
 };
 
+// Message is formatted into a buffer of the calling thread, ~Log puts
+// it into a ring of that thread. Background thread writes rings to stdout,
+// lines that do not fit into a full ring are dropped and counted.
 class Log {
 public:
 	Log();
@@ -18,26 +28,25 @@ public:
 	static LogLvl& ReportingLevel();
 	static std::string toString(LogLvl level);
 	static LogLvl FromString(const std::string &level);
+	// write all queued lines now
+	static void Flush();
+	static unsigned long Dropped();
 protected:
 
 private:
 	Log(const Log&);
 	Log& operator =(const Log&);
+	// unit test hooks: background writer does not write while held,
+	// queued lines may be thrown away instead of written
+	friend struct LogTest;
+	static void HoldWriter(bool on);
+	static void Discard();
+	static size_t RingLines();
 };
 
 inline Log::Log() {
 }
 
-inline std::ostream& Log::Get(LogLvl level) {
-	cout << toString(level) << ": ";
-	return cout;
-}
-
-inline Log::~Log() {
-	cout << std::endl;
-	cout.flush();
-}
-
 inline LogLvl& Log::ReportingLevel() {
 	static LogLvl reportingLevel = LogLvl::DEBUG;
 	return reportingLevel;
@@ -51,7 +60,7 @@ inline std::string Log::toString(LogLvl level) {
 typedef Log LOG;
 
 #define LOG(level) \
-    if (level < LOG::ReportingLevel()) ; \
+    if (static_cast<int>(level) < LOG_MIN_LEVEL || level < LOG::ReportingLevel()) ; \
     else Log().Get(level)
 
 #endif
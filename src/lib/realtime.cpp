@@ -0,0 +1,91 @@
+#include "realtime.hpp"
+#include "log.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+bool set_fifo_priority(int priority) {
+	sched_param param = {};
+	param.sched_priority = priority;
+	int result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (result == EPERM) {
+		LOG(LogLvl::ERROR) << "No permission for SCHED_FIFO priority " << priority
+			<< ": run as root, give CAP_SYS_NICE or set rtprio in /etc/security/limits.conf";
+		return false;
+	}
+	if (result != 0) {
+		LOG(LogLvl::ERROR) << "Cannot set SCHED_FIFO priority " << priority << ": " << strerror(result);
+		return false;
+	}
+	LOG(LogLvl::INFO) << "Scheduling SCHED_FIFO priority: " << priority;
+	return true;
+}
+
+bool set_cpu_affinity(const std::vector<int>& cpus) {
+	if (cpus.empty())
+		return true;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu : cpus)
+		CPU_SET(cpu, &set);
+	int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (result != 0) {
+		LOG(LogLvl::ERROR) << "Cannot set CPU affinity: " << strerror(result);
+		return false;
+	}
+	LOG(LogLvl::INFO) << "CPU affinity set, CPU count: " << cpus.size();
+	return true;
+}
+
+bool lock_memory() {
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+		LOG(LogLvl::INFO) << "Memory locked";
+		return true;
+	}
+	if (errno == EPERM || errno == ENOMEM) {
+		LOG(LogLvl::ERROR) << "No permission to lock memory: run as root, give CAP_IPC_LOCK"
+			<< " or raise memlock in /etc/security/limits.conf";
+	}
+	else {
+		LOG(LogLvl::ERROR) << "Cannot lock memory: " << strerror(errno);
+	}
+	return false;
+}
+
+void prefault_stack(size_t size) {
+	// touch stack pages now so they do not fault on the event path
+	volatile unsigned char* buf = static_cast<volatile unsigned char*>(alloca(size));
+	const long page = sysconf(_SC_PAGESIZE);
+	for (size_t i = 0; i < size; i += page)
+		buf[i] = 0;
+}
+
+void prefault_heap(size_t size) {
+	// freed memory stays in the heap, later allocations use faulted pages
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+	unsigned char* buf = static_cast<unsigned char*>(malloc(size));
+	if (buf == nullptr)
+		return;
+	const long page = sysconf(_SC_PAGESIZE);
+	for (size_t i = 0; i < size; i += page)
+		buf[i] = 0;
+	free(buf);
+}
+
+bool set_realtime(const RealtimeConfig& cfg) {
+	bool ok = lock_memory();
+	prefault_heap(cfg.heap_prefault);
+	prefault_stack(cfg.stack_prefault);
+	ok = set_cpu_affinity(cfg.cpus) && ok;
+	ok = set_fifo_priority(cfg.priority) && ok;
+	if (!ok) {
+		LOG(LogLvl::ERROR) << "Realtime mode is not fully enabled, see errors above";
+	}
+	return ok;
+}
@@ -0,0 +1,26 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// Settings of --realtime mode, applied to the calling thread before
+// the converter starts. Threads created later inherit policy and CPU set.
+struct RealtimeConfig {
+	int priority = 70; // SCHED_FIFO priority 1 .. 99
+	std::vector<int> cpus; // empty means all CPUs
+	size_t stack_prefault = 256 * 1024;
+	size_t heap_prefault = 8 * 1024 * 1024;
+};
+
+// returns false if some of the settings were not applied, reasons are logged
+bool set_realtime(const RealtimeConfig& cfg);
+
+bool set_fifo_priority(int priority);
+bool set_cpu_affinity(const std::vector<int>& cpus);
+bool lock_memory();
+void prefault_stack(size_t size);
+void prefault_heap(size_t size);
+
+#endif
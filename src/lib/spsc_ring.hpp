@@ -0,0 +1,65 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+// Lock free ring buffer for one producer thread and one consumer thread.
+// Capacity must be a power of two. Producer also keeps the highest occupancy seen.
+template<typename T>
+class SpscRing {
+public:
+	explicit SpscRing(size_t capacity) : mask(capacity - 1), buf(capacity) {
+		if (capacity == 0 || (capacity & mask) != 0)
+			throw std::invalid_argument("SpscRing capacity must be a power of two");
+	}
+
+	// producer side, returns false if ring is full
+	bool push(const T& v) {
+		const size_t h = head.load(std::memory_order_relaxed);
+		const size_t used = h - tail.load(std::memory_order_acquire);
+		if (used > mask)
+			return false;
+		buf[h & mask] = v;
+		head.store(h + 1, std::memory_order_release);
+		if (used + 1 > high_water.load(std::memory_order_relaxed))
+			high_water.store(used + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// consumer side, returns false if ring is empty
+	bool pop(T& v) {
+		const size_t t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire))
+			return false;
+		v = buf[t & mask];
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	size_t size() const {
+		return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+	}
+	bool empty() const {
+		return size() == 0;
+	}
+	size_t capacity() const {
+		return mask + 1;
+	}
+	size_t max_size() const {
+		return high_water.load(std::memory_order_relaxed);
+	}
+
+private:
+	// producer and consumer indexes on separate cache lines
+	std::atomic<size_t> head { 0 };
+	char pad1[64 - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> tail { 0 };
+	char pad2[64 - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> high_water { 0 };
+	const size_t mask;
+	std::vector<T> buf;
+};
+
+#endif
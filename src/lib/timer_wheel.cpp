@@ -0,0 +1,150 @@
+#include "timer_wheel.hpp"
+#include <algorithm>
+
+TimerWheel::TimerWheel(size_t keys, handler_t handler, int tick_ms, size_t n_slots) :
+	handler(handler), tick(std::chrono::milliseconds(tick_ms)), nodes(keys), slots(n_slots, -1) {
+	fired.reserve(keys);
+}
+
+TimerWheel::~TimerWheel() {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+	}
+	cv.notify_all();
+	if (worker.joinable())
+		worker.join();
+}
+
+void TimerWheel::setClock(const Clock& c) {
+	std::lock_guard<std::mutex> lock(mtx);
+	clock = &c;
+	epoch = c.now();
+	current = 0;
+	if (c.isVirtual())
+		own_thread = false;
+}
+
+void TimerWheel::link(int key) {
+	Node& n = nodes[key];
+	int& head = slots[n.expires % slots.size()];
+	n.prev = -1;
+	n.next = head;
+	if (head >= 0)
+		nodes[head].prev = key;
+	head = key;
+	n.armed = true;
+	armed++;
+}
+
+void TimerWheel::unlink(int key) {
+	Node& n = nodes[key];
+	if (n.prev >= 0)
+		nodes[n.prev].next = n.next;
+	else
+		slots[n.expires % slots.size()] = n.next;
+	if (n.next >= 0)
+		nodes[n.next].prev = n.prev;
+	n.prev = n.next = -1;
+	n.armed = false;
+	armed--;
+}
+
+void TimerWheel::schedule(int key, int delay_ms, uint64_t arg) {
+	std::unique_lock<std::mutex> lock = guard();
+	if (nodes[key].armed)
+		unlink(key);
+	const clock_t::duration delay = std::chrono::milliseconds(delay_ms);
+	const uint64_t ticks = (delay + tick - clock_t::duration(1)) / tick;
+	Node& n = nodes[key];
+	n.expires = std::max(tickAt(clock->now()) + ticks, current + 1);
+	n.arg = arg;
+	link(key);
+	if (own_thread && !started) {
+		started = true;
+		worker = std::thread(&TimerWheel::run, this);
+	}
+	if (lock.owns_lock()) {
+		lock.unlock();
+		cv.notify_one();
+	}
+}
+
+void TimerWheel::cancel(int key) {
+	std::unique_lock<std::mutex> lock = guard();
+	if (nodes[key].armed)
+		unlink(key);
+}
+
+bool TimerWheel::isArmed(int key) const {
+	std::unique_lock<std::mutex> lock = guard();
+	return nodes[key].armed;
+}
+
+size_t TimerWheel::armedCount() const {
+	std::unique_lock<std::mutex> lock = guard();
+	return armed;
+}
+
+size_t TimerWheel::advance(clock_t::time_point now) {
+	std::unique_lock<std::mutex> lock = guard();
+	const uint64_t to = tickAt(now);
+	if (to <= current)
+		return 0;
+	// after a long pause every slot is visited only once
+	const uint64_t steps = std::min<uint64_t>(to - current, slots.size());
+	fired.clear();
+	for (uint64_t t = current + 1; t <= current + steps; t++) {
+		int key = slots[t % slots.size()];
+		while (key >= 0) {
+			int next = nodes[key].next;
+			if (nodes[key].expires <= to) {
+				unlink(key);
+				fired.push_back(std::make_pair(key, nodes[key].arg));
+			}
+			key = next;
+		}
+	}
+	current = to;
+	if (lock.owns_lock())
+		lock.unlock();
+	// handler is called without lock so it may arm timers again
+	for (size_t i = 0; i < fired.size(); i++)
+		handler(fired[i].first, fired[i].second);
+	return fired.size();
+}
+
+uint64_t TimerWheel::nextTick() const {
+	// first non empty slot, timer in it may be for the next turn of the wheel
+	for (uint64_t t = current + 1; t <= current + slots.size(); t++) {
+		if (slots[t % slots.size()] >= 0)
+			return t;
+	}
+	return current + 1;
+}
+
+bool TimerWheel::nextDeadline(clock_t::time_point& t) const {
+	std::unique_lock<std::mutex> lock = guard();
+	if (armed == 0)
+		return false;
+	t = epoch + tick * nextTick();
+	return true;
+}
+
+void TimerWheel::run() {
+	std::unique_lock<std::mutex> lock(mtx);
+	while (!stopping) {
+		if (armed == 0) {
+			cv.wait(lock);
+			continue;
+		}
+		const clock_t::time_point next = epoch + tick * nextTick();
+		if (clock->now() < next) {
+			cv.wait_until(lock, next);
+			continue;
+		}
+		lock.unlock();
+		advance(clock->now());
+		lock.lock();
+	}
+}
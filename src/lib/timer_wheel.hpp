@@ -0,0 +1,89 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include "clock.hpp"
+
+// Hashed timer wheel with one timer per key (0 .. keys-1).
+// Arming, re-arming and cancelling a timer are O(1), expired timers call
+// the handler with key and argument given when the timer was armed.
+// By default one thread drives the wheel, it is started on the first
+// schedule() and sleeps while no timer is armed. Without own thread an event
+// loop calls advance() at nextDeadline(). Time is read from Clock, with
+// virtual clock the wheel has no thread and is advanced by the owner of clock.
+// Wheel without own thread takes no lock, only one thread may use it.
+class TimerWheel {
+public:
+	typedef std::function<void(int key, uint64_t arg)> handler_t;
+	typedef std::chrono::steady_clock clock_t;
+
+	TimerWheel(size_t keys, handler_t handler, int tick_ms = 10, size_t slots = 128);
+	virtual ~TimerWheel();
+
+	// arm timer for key, replaces the timer armed earlier for the same key
+	void schedule(int key, int delay_ms, uint64_t arg);
+	void cancel(int key);
+	bool isArmed(int key) const;
+	size_t armedCount() const;
+
+	// must be set before the first schedule(), without own thread wheel is not locked
+	void setThreaded(bool threaded) {
+		own_thread = threaded;
+	}
+	// must be set before the first schedule(), clock must live longer than wheel
+	void setClock(const Clock& c);
+	const Clock& getClock() const {
+		return *clock;
+	}
+	// time to call advance(), false if no timer is armed
+	bool nextDeadline(clock_t::time_point& t) const;
+
+	// fire timers expired at the moment now, returns number of fired timers,
+	// called by the wheel thread, it must not be called by two threads at once
+	size_t advance(clock_t::time_point now);
+
+private:
+	struct Node {
+		int prev = -1, next = -1;
+		uint64_t expires = 0; // tick number
+		uint64_t arg = 0;
+		bool armed = false;
+	};
+
+	const handler_t handler;
+	const clock_t::duration tick;
+	const Clock* clock = &Clock::system();
+	clock_t::time_point epoch = clock->now();
+	std::vector<Node> nodes;
+	std::vector<int> slots; // head node of each slot list
+	std::vector<std::pair<int, uint64_t>> fired;
+	uint64_t current = 0; // last processed tick
+	size_t armed = 0;
+
+	mutable std::mutex mtx;
+	std::condition_variable cv;
+	std::thread worker;
+	bool own_thread = true;
+	bool started = false;
+	bool stopping = false;
+
+	// wheel is shared with own thread, else lock is not taken
+	std::unique_lock<std::mutex> guard() const {
+		return own_thread ? std::unique_lock<std::mutex>(mtx) : std::unique_lock<std::mutex>();
+	}
+	uint64_t tickAt(clock_t::time_point t) const {
+		return (t - epoch) / tick;
+	}
+	void link(int key);
+	void unlink(int key);
+	uint64_t nextTick() const;
+	void run();
+};
+
+#endif
@@ -1,4 +1,6 @@
 #include "utils.hpp"
+#include <cstring>
+#include <pthread.h>
 
 bool writeMidiEvent(snd_seq_event_t* event, const MidiEvent& ev) {
 	// note OFF is note ON with zero velocity
@@ -46,6 +48,7 @@ bool readMidiEvent(const snd_seq_event_t* event, MidiEvent& ev) {
 		ev.evtype = MidiEventType::PROGCHANGE;
 		ev.ch = event->data.control.channel;
 		ev.v1 = event->data.control.value;
+		ev.v2 = 0;
 		return true;
 	}
 	if (event->type == SND_SEQ_EVENT_CONTROLLER) {
@@ -86,10 +89,21 @@ int replace_all(std::string& s, const std::string& del, const std::string& repl)
 }
 
 void remove_spaces(std::string& s) {
-	s = s.substr(0, s.find(";"));
-	replace_all(s, " ", "");
-	replace_all(s, "\n", "");
-	replace_all(s, "\t", "");
+	// one pass in place, comment after ';' is dropped
+	size_t k = 0;
+	for (size_t i = 0; i < s.size() && s[i] != ';'; i++) {
+		if (s[i] != ' ' && s[i] != '\n' && s[i] != '\t')
+			s[k++] = s[i];
+	}
+	s.resize(k);
+}
+
+bool read_file(const std::string& fileName, std::string& text) {
+	std::ifstream f(fileName, std::ios::binary);
+	if (!f.seekg(0, std::ios::end))
+		return false;
+	text.resize(f.tellg());
+	return static_cast<bool>(f.seekg(0).read(&text[0], text.size()));
 }
 
 std::string exec_command(const std::string& cmd) {
@@ -112,3 +126,28 @@ std::string exec_command(const std::string& cmd) {
 }
 
 
+
+bool pin_thread(std::thread& t, int cpu) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	int result = pthread_setaffinity_np(t.native_handle(), sizeof(set), &set);
+	if (result != 0) {
+		LOG(LogLvl::WARN) << "Cannot pin thread to CPU " << cpu << ": " << strerror(result);
+		return false;
+	}
+	return true;
+}
+
+std::vector<int> parse_int_list(const std::string& s) {
+	std::vector<int> result;
+	for (const std::string& part : split_string(s, ",")) {
+		try {
+			result.push_back(std::stoi(part));
+		}
+		catch (std::exception& e) {
+			throw MidiAppError("Not valid number list: " + s, true);
+		}
+	}
+	return result;
+}
@@ -12,7 +12,13 @@ std::vector<std::string> split_string(const std::string& s,
 int replace_all(std::string& s, const std::string& del,
 	const std::string& repl);
 void remove_spaces(std::string& s);
+// reads whole file, returns false if it cannot be read
+bool read_file(const std::string& fileName, std::string& text);
 std::string exec_command(const std::string& cmd);
+// pin thread to one CPU, returns false if not allowed
+bool pin_thread(std::thread& t, int cpu);
+// parse list like 1,2,3
+std::vector<int> parse_int_list(const std::string& s);
 
 
 
@@ -3,17 +3,75 @@
 #include "RuleMapper.hpp"
 #include "MidiClient.hpp"
 #include "MidiConverter.hpp"
+#include "lib/realtime.hpp"
+#include "SmfConverter.hpp"
+#include <csignal>
+#include <sys/stat.h>
 
 
 void help();
 
+namespace {
+// learned COUNT timeouts are kept for next start
+void save_count_timeout(RuleMapper* mapper, const char* countFile) {
+	if (countFile == nullptr)
+		return;
+	if (!mapper->get_count_timeout().save(countFile)) {
+		LOG(LogLvl::ERROR) << "Failed to save COUNT timeouts to: " << countFile;
+	}
+}
+
+// SIGUSR1 prints latency report, SIGINT and SIGTERM print it and exit
+void wait_signals(sigset_t signals, MidiConverter* converter, RuleMapper* mapper, const char* countFile) {
+	while (true) {
+		int sig = 0;
+		if (sigwait(&signals, &sig) != 0)
+			continue;
+		cout << converter->get_latency().toString() << std::endl;
+		if (countFile != nullptr)
+			cout << mapper->get_count_timeout().toString() << std::endl;
+		if (sig == SIGUSR1)
+			continue;
+		converter->stop_recording();
+		save_count_timeout(mapper, countFile);
+		Log::Flush();
+		std::_Exit(0);
+	}
+}
+}
+
 int main(int argc, char* argv[]) {
 
 	const char* ruleFile = nullptr;
 	const char* clientName = nullptr;
 	const char* sourceName = nullptr;
+	// rules compiled into app are used if the rule file is the same
+	const char* engineName = generated_rules() != nullptr ? "generated" : "table";
+	bool reactor = false;
+	bool pipelined = false;
+	const char* pipelineCpus = "";
+	bool realtime = false;
+	const char* rtPriority = nullptr;
+	const char* rtCpus = "";
+	const char* recordFile = nullptr;
+	const char* replayFile = nullptr;
+	bool replayFast = false;
+	const char* smfIn = nullptr;
+	const char* smfOut = nullptr;
+	const char* smfJobs = "0";
+	bool watchRules = true;
+	const char* countFile = nullptr;
+	const char* countWindow = nullptr;
 	LOG::ReportingLevel() = LogLvl::ERROR;
 
+	// signals are handled by one thread, block them before any thread starts
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
 	for (int i = 1; i < argc; i++) {
 		if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
 			sourceName = argv[i + 1];
@@ -24,6 +82,53 @@ int main(int argc, char* argv[]) {
 		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
 			clientName = argv[i + 1];
 		}
+		else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+			engineName = argv[i + 1];
+		}
+		else if (strcmp(argv[i], "--reactor") == 0) {
+			reactor = true;
+		}
+		else if (strcmp(argv[i], "--pipeline") == 0) {
+			pipelined = true;
+		}
+		else if (strcmp(argv[i], "--pipeline-cpus") == 0 && i + 1 < argc) {
+			pipelined = true;
+			pipelineCpus = argv[i + 1];
+		}
+		else if (strcmp(argv[i], "--realtime") == 0) {
+			realtime = true;
+		}
+		else if (strcmp(argv[i], "--rt-priority") == 0 && i + 1 < argc) {
+			rtPriority = argv[i + 1];
+		}
+		else if (strcmp(argv[i], "--rt-cpus") == 0 && i + 1 < argc) {
+			rtCpus = argv[i + 1];
+		}
+		else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			recordFile = argv[i + 1];
+		}
+		else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+			replayFile = argv[i + 1];
+		}
+		else if (strcmp(argv[i], "--fast") == 0) {
+			replayFast = true;
+		}
+		else if (strcmp(argv[i], "--smf") == 0 && i + 2 < argc) {
+			smfIn = argv[i + 1];
+			smfOut = argv[i + 2];
+		}
+		else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+			smfJobs = argv[i + 1];
+		}
+		else if (strcmp(argv[i], "--no-watch") == 0) {
+			watchRules = false;
+		}
+		else if (strcmp(argv[i], "--count-adapt") == 0 && i + 1 < argc) {
+			countFile = argv[i + 1];
+		}
+		else if (strcmp(argv[i], "--count-window") == 0 && i + 1 < argc) {
+			countWindow = argv[i + 1];
+		}
 		else if (strcmp(argv[i], "-v") == 0) {
 			LOG::ReportingLevel() = LogLvl::WARN;
 		}
@@ -42,7 +147,27 @@ int main(int argc, char* argv[]) {
 		help();
 		return 2;
 	}
-	if (sourceName == nullptr) {
+	if (smfIn != nullptr) {
+		try {
+			SmfConverter smfConverter(ruleFile, RuleMapper::engineFromString(engineName));
+			struct stat st;
+			if (stat(smfIn, &st) == 0 && S_ISDIR(st.st_mode)) {
+				size_t n = smfConverter.convertDirectory(smfIn, smfOut, std::stoi(smfJobs));
+				cout << "Converted MIDI files: " << n << std::endl;
+			}
+			else {
+				size_t n = smfConverter.convertFile(smfIn, smfOut);
+				cout << "Converted MIDI events: " << n << std::endl;
+			}
+			Log::Flush();
+			return 0;
+		}
+		catch (std::exception& e) {
+			LOG(LogLvl::ERROR) << "MIDI file conversion failed: " << e.what();
+			return 1;
+		}
+	}
+	if (sourceName == nullptr && replayFile == nullptr) {
 		help();
 		return 2;
 	}
@@ -53,22 +178,78 @@ int main(int argc, char* argv[]) {
 	LOG(LogLvl::INFO) << "Rule file: " << ruleFile;
 	RuleMapper* ruleMapper = nullptr;
 	MidiClient* midiClient = nullptr;
+	std::unique_ptr<MidiConverter> midiConverter;
 
 
 	try {
 
 		midiClient = new MidiClient(clientName, sourceName, nullptr);
-		LOG(LogLvl::INFO) << "Using midi port as source: " << sourceName;
+		if (sourceName != nullptr) {
+			LOG(LogLvl::INFO) << "Using midi port as source: " << sourceName;
+		}
 
-		ruleMapper = new RuleMapper(ruleFile, midiClient);
+		ruleMapper = new RuleMapper(ruleFile, midiClient, RuleMapper::engineFromString(engineName));
+		if (countFile != nullptr) {
+			CountTimeoutConfig countConfig;
+			if (countWindow != nullptr) {
+				std::vector<int> w = parse_int_list(countWindow);
+				if (w.size() != 4)
+					throw std::invalid_argument("COUNT window needs percentile,margin,min,max");
+				countConfig.percentile = w[0];
+				countConfig.margin_ms = w[1];
+				countConfig.min_ms = w[2];
+				countConfig.max_ms = w[3];
+			}
+			CountTimeout& countTimeout = ruleMapper->get_count_timeout();
+			countTimeout.setAdaptive(countConfig);
+			if (countTimeout.load(countFile)) {
+				LOG(LogLvl::INFO) << countTimeout.toString();
+			}
+		}
+
+		midiConverter.reset(new MidiConverter(ruleMapper));
+		std::thread(wait_signals, signals, midiConverter.get(), ruleMapper, countFile).detach();
 
-		MidiConverter midiConverter = MidiConverter(ruleMapper);
+		if (realtime) {
+			RealtimeConfig rtConfig;
+			if (rtPriority != nullptr)
+				rtConfig.priority = std::stoi(rtPriority);
+			if (*rtCpus)
+				rtConfig.cpus = parse_int_list(rtCpus);
+			// threads started after this inherit policy, CPU set and locked memory
+			set_realtime(rtConfig);
+		}
+
+		if (recordFile != nullptr)
+			midiConverter->start_recording(recordFile);
+
+		if (replayFile != nullptr) {
+			size_t n = midiConverter->replay_trace(replayFile, replayFast);
+			cout << "Replayed events: " << n << std::endl
+				<< midiConverter->get_latency().toString() << std::endl;
+			midiConverter->stop_recording();
+			save_count_timeout(ruleMapper, countFile);
+			return 0;
+		}
+
+		if (watchRules)
+			ruleMapper->watchFile();
 
 		LOG(LogLvl::INFO) << "Starting MIDI messages processing";
-		midiConverter.process_events();
+		if (reactor)
+			midiConverter->process_events_reactor();
+		else if (pipelined)
+			midiConverter->process_events_pipelined(
+				*pipelineCpus ? parse_int_list(pipelineCpus) : std::vector<int>());
+		else
+			midiConverter->process_events();
 	}
 	catch (std::exception& e) {
 		LOG(LogLvl::ERROR) << "Completed with error: " << e.what();
+		if (midiConverter) {
+			midiConverter->stop_recording();
+			cout << midiConverter->get_latency().toString() << std::endl;
+		}
 		return 1;
 	}
 }
@@ -79,8 +260,25 @@ void help() {
 		"  -i <sourceName> MIDI source to connect to\n"
 		"options:\n"
 		"  -n [name] output MIDI port name to create\n"
+		"  -e [engine] rule matching: scan, index, simd, table (default), generated (default if built with make app RULES=<file>)\n"
+		"  --reactor input, count timers and output on one thread with epoll\n"
+		"  --pipeline reader, mapper and writer threads connected with lock free rings\n"
+		"  --pipeline-cpus <r,m,w> pipeline with reader, mapper and writer pinned to CPUs\n"
+		"  --realtime SCHED_FIFO scheduling, locked and prefaulted memory\n"
+		"  --rt-priority <n> SCHED_FIFO priority for --realtime, default 70\n"
+		"  --rt-cpus <list> CPUs for --realtime threads, e.g. 2,3\n"
+		"  --record <file> write input events with their timing to binary trace file\n"
+		"  --replay <file> send events of trace file through rules with original timing, -i is not needed\n"
+		"  --fast replay trace at once, count rules use virtual time of trace\n"
+		"  --smf <in> <out> convert MIDI file or directory of MIDI files with rules, no MIDI ports are used\n"
+		"  --jobs <n> threads converting directory of MIDI files, default is number of CPUs\n"
+		"  --no-watch do not reload rules when rule file changes\n"
+		"  --count-adapt <file> learn COUNT timeout of each note from taps, kept in file between starts\n"
+		"  --count-window <p,m,min,max> learned timeout is percentile p of tap intervals plus m ms, in min..max ms, default 95,50,200,1000\n"
 		"  -v verbose output\n"
 		"  -vv more verbose\n"
 		"  -vvv even more verbose\n"
-		"  -h displays this info\n";
+		"  -h displays this info\n"
+		"signals:\n"
+		"  SIGUSR1 prints latency percentiles per event type, SIGINT and SIGTERM print them and exit\n";
 }
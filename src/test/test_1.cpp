@@ -3,6 +3,19 @@
 #include "lib/utils.hpp"
 #include "catch.hpp"
 
+// friend of Log, controls background writer of log lines
+struct LogTest {
+	static void hold(bool on) {
+		Log::HoldWriter(on);
+	}
+	static void discard() {
+		Log::Discard();
+	}
+	static size_t ring_lines() {
+		return Log::RingLines();
+	}
+};
+
 TEST_CASE("Test LOG 1", "[all][basic]") {
 
 	SECTION("Section print 1") {
@@ -25,6 +38,24 @@ TEST_CASE("Test LOG 1", "[all][basic]") {
 		LOG(LogLvl::ERROR) << "TEST3";
 		LOG::ReportingLevel() = LogLvl::DEBUG;
 	}
+
+	SECTION("Section print 3") {
+		// long line is cut, full ring drops lines instead of waiting
+		LOG(LogLvl::INFO) << std::string(1000, 'x');
+		LogTest::hold(true);
+		Log::Flush();
+		const unsigned long dropped = Log::Dropped();
+		const size_t overflow = 10;
+		for (size_t i = 0; i < LogTest::ring_lines() + overflow; i++)
+			LOG(LogLvl::ERROR) << "TEST4 " << i;
+		REQUIRE(Log::Dropped() - dropped == overflow);
+		// queued test lines are not written
+		LogTest::discard();
+		LogTest::hold(false);
+		std::thread t([]() { LOG(LogLvl::INFO) << "TEST5 from other thread"; });
+		t.join();
+		Log::Flush();
+	}
 }
 
 TEST_CASE("Test split_string 1", "[all][basic]") {
@@ -135,3 +166,16 @@ TEST_CASE("Test MidiEvent 2", "[all][basic]") {
 	}
 }
 
+
+TEST_CASE("Test MidiEvent compare", "[all][basic]") {
+	SECTION("Section equal and similar") {
+		MidiEvent e1("n,1,60,100"), e2("n,1,60,0"), e3("n,1,61,100"), e4("c,1,60,100"), e5("n,2,60,100");
+		REQUIRE(e1.isEqual(MidiEvent("n,1,60,100")));
+		REQUIRE(!e1.isEqual(e2));
+		REQUIRE(e1.isSimilar(e2));
+		REQUIRE(!e1.isSimilar(e3));
+		REQUIRE(!e1.isSimilar(e4));
+		REQUIRE(!e1.isSimilar(e5));
+		REQUIRE(e1.packed() != e2.packed());
+	}
+}
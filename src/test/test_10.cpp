@@ -0,0 +1,100 @@
+#include "pch.hpp"
+#include "EventTrace.hpp"
+#include "MidiConverter.hpp"
+#include "LoopbackTransport.hpp"
+#include "catch.hpp"
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+
+TEST_CASE("Test EventTrace 1", "[all]") {
+	const std::string file = "/tmp/mimap_test_" + std::to_string(getpid()) + ".trace";
+	const char types[] = { 'n', 'c', 'p', 'a' };
+	std::vector<MidiEvent> events;
+	std::vector<uint64_t> deltas;
+	unsigned int seed = 3;
+	for (int k = 0; k < 1000; k++) {
+		seed = seed * 1103515245 + 12345;
+		MidiEvent ev;
+		ev.evtype = static_cast<MidiEventType>(types[(seed >> 8) % 4]);
+		ev.ch = (seed >> 10) % 16;
+		ev.v1 = (seed >> 14) % 128;
+		ev.v2 = (seed >> 21) % 128;
+		events.push_back(ev);
+		// small and large gaps, varint of 1 to 4 bytes
+		deltas.push_back(k == 0 ? 0 : (seed >> 4) % (k % 4 == 0 ? 100000000 : 100));
+	}
+
+	SECTION("Section write and read back") {
+		TraceWriter writer(file);
+		std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+		for (size_t k = 0; k < events.size(); k++) {
+			t += std::chrono::microseconds(deltas[k]);
+			REQUIRE(writer.record(events[k], t));
+		}
+		writer.close();
+		REQUIRE(writer.written() == events.size());
+		REQUIRE(writer.dropped() == 0);
+
+		TraceReader reader(file);
+		MidiEvent ev;
+		uint64_t delta_us;
+		int mismatch = 0;
+		for (size_t k = 0; k < events.size(); k++) {
+			REQUIRE(reader.next(ev, delta_us));
+			if (!ev.isEqual(events[k]) || delta_us != deltas[k])
+				mismatch++;
+		}
+		REQUIRE(mismatch == 0);
+		REQUIRE(!reader.next(ev, delta_us));
+		reader.rewind();
+		REQUIRE(reader.next(ev, delta_us));
+		REQUIRE(ev.isEqual(events[0]));
+	}
+
+	SECTION("Section not a trace file") {
+		const std::string text = file + ".txt";
+		std::ofstream(text) << "n,5,,=n,2,3,5=s ; rules, not a trace\n";
+		CHECK_THROWS_AS(TraceReader(text), MidiAppError);
+		std::remove(text.c_str());
+		REQUIRE_THROWS_AS(TraceReader(file + ".missing"), std::runtime_error);
+	}
+	std::remove(file.c_str());
+}
+
+TEST_CASE("Test EventTrace 2", "[all]") {
+	const std::string file = "/tmp/mimap_test_" + std::to_string(getpid()) + "_2.trace";
+	{
+		// double tap of note 60 and CC two seconds later
+		TraceWriter writer(file);
+		std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+		const char* input[] = { "n,0,60,100", "n,0,60,0", "n,0,60,100", "n,0,60,0", "c,1,7,50" };
+		const int gaps_ms[] = { 0, 100, 200, 100, 2000 };
+		for (int k = 0; k < 5; k++) {
+			t += std::chrono::milliseconds(gaps_ms[k]);
+			writer.record(MidiEvent(input[k]), t);
+		}
+	}
+	LoopbackTransport c1;
+	RuleMapper r1("", &c1);
+	r1.parseString("n,0,60,=c");
+	r1.parseString("c,,,=n,2,,=s");
+	r1.compile();
+	MidiConverter conv(&r1);
+
+	SECTION("Section fast replay with virtual time") {
+		auto start = std::chrono::steady_clock::now();
+		REQUIRE(conv.replay_trace(file, true) == 5);
+		REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(1));
+		std::vector<std::string> out;
+		snd_seq_event_t event;
+		MidiEvent ev;
+		while (c1.take_output(event)) {
+			REQUIRE(readMidiEvent(&event, ev));
+			out.push_back(ev.toString());
+		}
+		std::sort(out.begin(), out.end());
+		REQUIRE(out == std::vector<std::string> { "n,0,60,100", "n,0,60,2", "n,2,7,50" });
+	}
+	std::remove(file.c_str());
+}
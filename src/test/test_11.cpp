@@ -0,0 +1,119 @@
+#include "pch.hpp"
+#include "SmfConverter.hpp"
+#include "catch.hpp"
+#include <cstdio>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+void write_file(const std::string& name, const std::vector<uint8_t>& bytes) {
+	std::ofstream f(name, std::ios::binary);
+	f.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+std::string read_file(const std::string& name) {
+	std::ifstream f(name, std::ios::binary);
+	return std::string(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+}
+
+// events of track as "tick:status,data bytes"
+std::vector<std::string> dump(const SmfReader& reader, uint16_t track) {
+	std::vector<std::string> v;
+	for (const SmfEvent& e : reader.events()) {
+		if (e.track != track)
+			continue;
+		std::ostringstream ss;
+		ss << e.tick << ":" << std::hex << static_cast<int>(e.status);
+		for (uint32_t i = 0; i < e.size; i++)
+			ss << "," << static_cast<int>(e.data[i]);
+		v.push_back(ss.str());
+	}
+	return v;
+}
+}
+
+TEST_CASE("Test MIDI file conversion", "[all]") {
+	const std::string dir = "/tmp/mimap_test_" + std::to_string(getpid());
+	mkdir(dir.c_str(), 0755);
+	const std::string rules = dir + "/rules.txt", in = dir + "/in.mid", out = dir + "/out.mid";
+	{
+		std::ofstream f(rules);
+		f << "n,0,60,=c\nc,,,=n,2,,=s\na,,,=a,,,=p\n";
+	}
+	// format 1, tempo 120 bpm, 480 ticks per quarter note, tick is 1.04 ms
+	write_file(in, {
+		'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1, 0, 2, 0x01, 0xE0,
+		'M', 'T', 'r', 'k', 0, 0, 0, 11,
+		0x00, 0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20,
+		0x00, 0xFF, 0x2F, 0x00,
+		'M', 'T', 'r', 'k', 0, 0, 0, 28,
+		0x00, 0x90, 0x3C, 0x64, // double tap of note 60 with running status
+		0x60, 0x3C, 0x00,
+		0x81, 0x40, 0x3C, 0x64,
+		0x60, 0x3C, 0x00,
+		0x8F, 0x00, 0xB1, 0x07, 0x32, // CC 7 two seconds later
+		0x83, 0x60, 0x91, 0x3E, 0x50,
+		0x00, 0xFF, 0x2F, 0x00 });
+
+	SECTION("Section convert one file") {
+		SmfConverter conv(rules);
+		REQUIRE(conv.convertFile(in, out) == 6);
+		SmfReader reader(out);
+		REQUIRE(reader.getFormat() == 1);
+		REQUIRE(reader.getTracks() == 2);
+		REQUIRE(reader.getDivision() == 480);
+		REQUIRE(dump(reader, 0) == std::vector<std::string> { "0:ff,51,3,7,a1,20", "0:ff,2f,0" });
+		// first note ON, counted note 900 ms after the last tap, converted CC and passed note
+		REQUIRE(dump(reader, 1) == std::vector<std::string> {
+			"0:90,3c,64", "864:90,3c,2", "2304:92,7,32", "2784:91,3e,50", "2784:ff,2f,0" });
+	}
+
+	SECTION("Section delayed output") {
+		{
+			std::ofstream f(rules);
+			f << "n,0,60,=c:d100\nc,,,=n,2,,=s:d500\na,,,=a,,,=p\n";
+		}
+		SmfConverter conv(rules);
+		REQUIRE(conv.convertFile(in, out) == 6);
+		SmfReader reader(out);
+		// counted note 100 ms and converted CC 500 ms later, before passed note of the same tick
+		REQUIRE(dump(reader, 1) == std::vector<std::string> {
+			"0:90,3c,64", "960:90,3c,2", "2784:92,7,32", "2784:91,3e,50", "2784:ff,2f,0" });
+	}
+
+	SECTION("Section convert directory on thread pool") {
+		SmfConverter conv(rules);
+		REQUIRE(conv.convertFile(in, out) == 6);
+		const std::string in_dir = dir + "/in", out_dir = dir + "/out";
+		mkdir(in_dir.c_str(), 0755);
+		const std::string names[] = { "a.mid", "b.MID", "c.midi", "d.txt" };
+		for (const std::string& s : names)
+			write_file(in_dir + "/" + s, std::vector<uint8_t>(1, 0));
+		for (int k = 0; k < 3; k++) {
+			std::ifstream src(in, std::ios::binary);
+			std::ofstream dst(in_dir + "/" + names[k], std::ios::binary);
+			dst << src.rdbuf();
+		}
+		REQUIRE(conv.convertDirectory(in_dir, out_dir, 2) == 3);
+		for (int k = 0; k < 3; k++) {
+			REQUIRE(read_file(out_dir + "/" + names[k]) == read_file(out));
+			std::remove((out_dir + "/" + names[k]).c_str());
+		}
+		for (const std::string& s : names)
+			std::remove((in_dir + "/" + s).c_str());
+		rmdir(in_dir.c_str());
+		rmdir(out_dir.c_str());
+	}
+
+	SECTION("Section bad files") {
+		write_file(in, { 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 2, 0, 1, 0x01, 0xE0 });
+		REQUIRE_THROWS_AS(SmfReader(in), MidiAppError);
+		write_file(in, { 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0x01, 0xE0,
+			'M', 'T', 'r', 'k', 0, 0, 0, 3, 0x00, 0x3C, 0x64 });
+		SmfReader reader(in);
+		REQUIRE_THROWS_AS(reader.events(), MidiAppError);
+	}
+	for (const std::string& s : { rules, in, out })
+		std::remove(s.c_str());
+	rmdir(dir.c_str());
+}
@@ -0,0 +1,121 @@
+#include "pch.hpp"
+#include "RuleMapper.hpp"
+#include "LoopbackTransport.hpp"
+#include "RuleCache.hpp"
+#include "lib/clock.hpp"
+#include "catch.hpp"
+#include <cstdio>
+#include <unistd.h>
+
+namespace {
+void write_file(const std::string& file, const std::string& text) {
+	std::ofstream f(file);
+	f << text;
+}
+
+std::string convert(RuleMapper& mapper, const std::string& s) {
+	MidiEvent ev(s);
+	return mapper.applyRules(ev) ? ev.toString() : "";
+}
+
+std::vector<std::string> output(LoopbackTransport& loopback) {
+	std::vector<std::string> v;
+	snd_seq_event_t event;
+	MidiEvent ev;
+	while (loopback.take_output(event)) {
+		if (readMidiEvent(&event, ev))
+			v.push_back(ev.toString());
+	}
+	return v;
+}
+}
+
+TEST_CASE("Test rule reload", "[all]") {
+	const std::string file = "/tmp/mimap_test_" + std::to_string(getpid()) + ".rules";
+	write_file(file, "n,0,60,=c\nn,0,61,=n,0,71,=s\n");
+	LoopbackTransport loopback;
+	VirtualClock clock;
+	RuleMapper mapper(file, &loopback);
+	mapper.setClock(clock);
+	auto wait = [&](int ms) {
+		clock.advance_ms(ms);
+		mapper.get_count_timer().advance(clock.now());
+	};
+	auto tap = [&](int gap_ms) {
+		convert(mapper, "n,0,60,100");
+		wait(100);
+		convert(mapper, "n,0,60,0");
+		wait(gap_ms);
+	};
+	REQUIRE(mapper.getSize() == 2);
+	REQUIRE(convert(mapper, "n,0,61,90") == "n,0,71,90");
+
+	SECTION("Section new rules are used, count state is kept") {
+		tap(200);
+		write_file(file, "n,0,60,=c\nn,0,61,=n,0,72,=s\nn,0,62,=n,0,73,=s\n");
+		REQUIRE(mapper.reload());
+		REQUIRE(mapper.getSize() == 3);
+		tap(1000);
+		REQUIRE(output(loopback) == std::vector<std::string> { "n,0,60,2" });
+		REQUIRE(convert(mapper, "n,0,61,90") == "n,0,72,90");
+		REQUIRE(convert(mapper, "n,0,62,90") == "n,0,73,90");
+	}
+
+	SECTION("Section count state is reset if count rules change") {
+		tap(200);
+		write_file(file, "n,0,60,=c\nn,0,62,=c\n");
+		REQUIRE(mapper.reload());
+		REQUIRE(mapper.get_count_timer().armedCount() == 1);
+		tap(1000);
+		REQUIRE(output(loopback) == std::vector<std::string> { "n,0,60,1" });
+		REQUIRE(convert(mapper, "n,0,61,90") == "");
+	}
+
+	SECTION("Section count state is reset after two reloads without events") {
+		tap(200);
+		// second rule set may get address of the first one
+		write_file(file, "n,0,60,=c\nn,0,61,=n,0,72,=s\n");
+		REQUIRE(mapper.reload());
+		write_file(file, "n,0,60,=c\nn,0,62,=c\n");
+		REQUIRE(mapper.reload());
+		tap(1000);
+		REQUIRE(output(loopback) == std::vector<std::string> { "n,0,60,1" });
+	}
+
+	SECTION("Section reload while events are processed") {
+		std::atomic<bool> stop { false };
+		std::atomic<int> bad { 0 };
+		std::thread events([&]() {
+			while (!stop) {
+				std::string s = convert(mapper, "n,0,61,90");
+				if (s != "n,0,71,90" && s != "n,0,72,90")
+					bad++;
+			}
+		});
+		for (int k = 0; k < 20; k++) {
+			write_file(file, k % 2 ? "n,0,61,=n,0,71,=s\n" : "n,0,61,=n,0,72,=s\n");
+			REQUIRE(mapper.reload());
+		}
+		stop = true;
+		events.join();
+		REQUIRE(bad == 0);
+	}
+
+	SECTION("Section file with errors is ignored") {
+		write_file(file, "n,0,61,=n,0,72,=s\nn,0,61=x\n");
+		REQUIRE_FALSE(mapper.reload());
+		REQUIRE(mapper.getSize() == 2);
+		REQUIRE(convert(mapper, "n,0,61,90") == "n,0,71,90");
+	}
+
+	SECTION("Section changed file is reloaded by watcher") {
+		mapper.watchFile();
+		write_file(file, "n,0,61,=n,0,74,=s\n");
+		for (int k = 0; k < 50 && mapper.getSize() != 1; k++)
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		REQUIRE(mapper.getSize() == 1);
+		REQUIRE(convert(mapper, "n,0,61,90") == "n,0,74,90");
+	}
+	std::remove(file.c_str());
+	std::remove(rule_cache_name(file).c_str());
+}
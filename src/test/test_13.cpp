@@ -0,0 +1,89 @@
+#include "pch.hpp"
+#include "RuleCache.hpp"
+#include "catch.hpp"
+#include <cstdio>
+#include <unistd.h>
+
+namespace {
+void write_file(const std::string& file, const std::string& text) {
+	std::ofstream f(file);
+	f << text;
+}
+
+// results of all rules for a sample of events
+std::string convert_all(const RuleSet& rs) {
+	std::ostringstream ss;
+	const char types[] = { 'n', 'c', 'p' };
+	for (char t : types) {
+		for (int ch = 0; ch < 16; ch += 3) {
+			for (int v = 0; v < 128; v += 7) {
+				MidiEvent ev;
+				ev.evtype = static_cast<MidiEventType>(t);
+				ev.ch = ch;
+				ev.v1 = v;
+				ev.v2 = 127 - v;
+				RuleTable::Outcome outcome = rs.table.isBuilt() ? rs.table.lookup(ev) : RuleTable::Outcome::INTERPRET;
+				ss << static_cast<int>(outcome) << ":" << ev.toString() << ":" << rs.findMatchingRule(ev, 0) << ";";
+			}
+		}
+	}
+	return ss.str();
+}
+}
+
+TEST_CASE("Test rule cache", "[all]") {
+	const std::string file = "/tmp/mimap_test_" + std::to_string(getpid()) + ".rules";
+	const std::string cache = rule_cache_name(file);
+	write_file(file, "n,0,60,=c\nn,1,,=n,2,,=s\nc,,1:20,=c,,30,=p\na,,,=p\n");
+	std::remove(cache.c_str());
+
+	RuleSet parsed(RuleEngine::TABLE);
+	REQUIRE(parsed.load(file) == 0);
+	REQUIRE(parsed.image == nullptr);
+	REQUIRE(parsed.table.isBuilt());
+
+	SECTION("Section image is used") {
+		RuleSet cached(RuleEngine::TABLE);
+		REQUIRE(cached.load(file) == 0);
+		REQUIRE(cached.image != nullptr);
+		REQUIRE(cached.table.data() != nullptr);
+		REQUIRE(cached.toString() == parsed.toString());
+		REQUIRE(convert_all(cached) == convert_all(parsed));
+
+		RuleSet index(RuleEngine::INDEX);
+		REQUIRE(index.load(file) == 0);
+		REQUIRE(index.image != nullptr);
+		REQUIRE(!index.table.isBuilt());
+		REQUIRE(index.toString() == parsed.toString());
+	}
+
+	SECTION("Section changed file is parsed") {
+		write_file(file, "n,0,60,=c\nn,1,,=n,3,,=s\n");
+		RuleSet changed(RuleEngine::TABLE);
+		REQUIRE(changed.load(file) == 0);
+		REQUIRE(changed.image == nullptr);
+		REQUIRE(changed.rules.size() == 2);
+		RuleSet cached(RuleEngine::TABLE);
+		cached.load(file);
+		REQUIRE(cached.image != nullptr);
+		REQUIRE(convert_all(cached) == convert_all(changed));
+	}
+
+	SECTION("Section bad image is not used") {
+		REQUIRE(truncate(cache.c_str(), 100) == 0);
+		RuleSet rs(RuleEngine::TABLE);
+		REQUIRE(rs.load(file) == 0);
+		REQUIRE(rs.image == nullptr);
+		REQUIRE(rs.toString() == parsed.toString());
+	}
+
+	SECTION("Section file with errors is not cached") {
+		write_file(file, "n,0,60,=c\nn,1=s\n");
+		std::remove(cache.c_str());
+		RuleSet rs(RuleEngine::TABLE);
+		REQUIRE(rs.load(file) == 1);
+		REQUIRE(access(cache.c_str(), F_OK) != 0);
+	}
+	std::remove(file.c_str());
+	std::remove(cache.c_str());
+}
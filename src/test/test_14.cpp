@@ -0,0 +1,78 @@
+#include "pch.hpp"
+#include "RuleMapper.hpp"
+#include "LoopbackTransport.hpp"
+#include "lib/clock.hpp"
+#include "RuleCache.hpp"
+#include "catch.hpp"
+#include <cstdio>
+#include <unistd.h>
+
+// app_t is linked with code generated from src/test/rules_gen.txt, its
+// absolute path is in generated code. Rules are copied so that rule cache
+// is not written to source tree
+TEST_CASE("Test generated rule code", "[all]") {
+	REQUIRE(generated_rules() != nullptr);
+	std::string text;
+	REQUIRE(read_file(generated_rules()->file_name, text));
+	const std::string file = "/tmp/mimap_test_" + std::to_string(getpid()) + "_gen.rules";
+	auto write_file = [&](const std::string& s) {
+		std::ofstream f(file);
+		f << s;
+	};
+	write_file(text);
+	LoopbackTransport loopback;
+	VirtualClock clock;
+	RuleMapper generated(file, &loopback, RuleEngine::GENERATED);
+	RuleMapper scan(file, &loopback, RuleEngine::SCAN);
+	generated.setClock(clock);
+	scan.setClock(clock);
+	REQUIRE(generated.getEngine() == RuleEngine::GENERATED);
+	REQUIRE(generated.getSize() == generated_rules()->rule_count);
+
+	SECTION("Section same results as interpreter") {
+		LogLvl old_level = LOG::ReportingLevel();
+		LOG::ReportingLevel() = LogLvl::ERROR;
+		const MidiEventType types[] = { MidiEventType::NOTE,
+			MidiEventType::CONTROLCHANGE, MidiEventType::PROGCHANGE };
+		int mismatch = 0;
+		for (MidiEventType t : types) {
+			for (int ch = 0; ch < 16; ch++) {
+				for (int v1 = 0; v1 < 128; v1++) {
+					for (int v2 = 0; v2 < 128; v2 += (t == MidiEventType::PROGCHANGE ? 128 : 1)) {
+						MidiEvent e1, e2;
+						e1.evtype = e2.evtype = t;
+						e1.ch = e2.ch = ch;
+						e1.v1 = e2.v1 = v1;
+						e1.v2 = e2.v2 = v2;
+						bool b1 = generated.applyRules(e1);
+						bool b2 = scan.applyRules(e2);
+						if (b1 != b2 || (b1 && !e1.isEqual(e2)))
+							mismatch++;
+					}
+				}
+			}
+		}
+		LOG::ReportingLevel() = old_level;
+		REQUIRE(mismatch == 0);
+	}
+
+	SECTION("Section other rules use table") {
+		RuleMapper other("", &loopback, RuleEngine::GENERATED);
+		other.parseString("n,,,=n,,,=s");
+		other.compile();
+		REQUIRE(other.getEngine() == RuleEngine::TABLE);
+		MidiEvent ev("n,1,2,3");
+		REQUIRE(other.applyRules(ev));
+	}
+
+	SECTION("Section generated code is used again after reload") {
+		write_file(text + "n,,,=n,,,=s\n");
+		REQUIRE(generated.reload());
+		REQUIRE(generated.getEngine() == RuleEngine::TABLE);
+		write_file(text);
+		REQUIRE(generated.reload());
+		REQUIRE(generated.getEngine() == RuleEngine::GENERATED);
+	}
+	std::remove(file.c_str());
+	std::remove(rule_cache_name(file).c_str());
+}
@@ -0,0 +1,211 @@
+#include "pch.hpp"
+#include "CountTimeout.hpp"
+#include "RuleMapper.hpp"
+#include "LoopbackTransport.hpp"
+#include "lib/clock.hpp"
+#include "catch.hpp"
+
+namespace {
+const int key = 60;
+
+// taps of one series with the same interval, returns last timeout
+int taps(CountTimeout& ct, VirtualClock& clock, int n, int interval_ms) {
+	int ms = ct.tap(key, clock.now(), false);
+	for (int i = 1; i < n; i++) {
+		clock.advance_ms(interval_ms);
+		ms = ct.tap(key, clock.now(), true);
+	}
+	clock.advance_ms(5000);
+	return ms;
+}
+}
+
+TEST_CASE("Test CountTimeout", "[all]") {
+	VirtualClock clock;
+	CountTimeout ct(600);
+	CountTimeoutConfig cfg;
+
+	SECTION("Section fixed timeout when not adaptive") {
+		REQUIRE(taps(ct, clock, 50, 150) == 600);
+		REQUIRE(ct.timeout(key) == 600);
+		REQUIRE(ct.samples(key) == 0);
+	}
+
+	SECTION("Section learned from taps") {
+		ct.setAdaptive(cfg);
+		// not enough taps yet
+		REQUIRE(taps(ct, clock, cfg.min_samples, 150) == 600);
+		REQUIRE(ct.samples(key) == static_cast<unsigned long>(cfg.min_samples - 1));
+		taps(ct, clock, 10, 150);
+		// bucket of 150 ms ends at 160, plus margin
+		REQUIRE(ct.timeout(key) == 160 + cfg.margin_ms);
+		REQUIRE(ct.timeout(key + 1) == 600);
+		// pauses between series are not learned
+		REQUIRE(ct.samples(key) == static_cast<unsigned long>(cfg.min_samples + 8));
+	}
+
+	SECTION("Section timeout within bounds") {
+		ct.setAdaptive(cfg);
+		taps(ct, clock, 50, 20);
+		REQUIRE(ct.timeout(key) == cfg.min_ms);
+		CountTimeout slow(600);
+		slow.setAdaptive(cfg);
+		taps(slow, clock, 50, 990);
+		REQUIRE(slow.timeout(key) == cfg.max_ms);
+		// longer intervals are not taps of one series
+		taps(slow, clock, 50, 1500);
+		REQUIRE(slow.samples(key) == 49);
+	}
+
+	SECTION("Section follows slower taps") {
+		ct.setAdaptive(cfg);
+		taps(ct, clock, 100, 150);
+		REQUIRE(ct.timeout(key) == 210);
+		for (int i = 0; i < 100; i++)
+			taps(ct, clock, 20, 200);
+		REQUIRE(ct.timeout(key) == 260);
+	}
+
+	SECTION("Section missed tap after timeout only") {
+		ct.setAdaptive(cfg);
+		ct.tap(key, clock.now(), false);
+		for (int i = 0; i < 30; i++) {
+			clock.advance_ms(100);
+			ct.tap(key, clock.now(), true);
+		}
+		REQUIRE(ct.timeout(key) == cfg.min_ms);
+		const unsigned long n = ct.samples(key);
+		// series ended by max count or hold, slower tap is a new series
+		ct.series_end(key, false);
+		clock.advance_ms(300);
+		ct.tap(key, clock.now(), false);
+		REQUIRE(ct.samples(key) == n);
+		// series ended on timeout, slower tap missed it
+		ct.series_end(key, true);
+		clock.advance_ms(300);
+		ct.tap(key, clock.now(), false);
+		REQUIRE(ct.samples(key) == n + 1);
+		// flag is used once
+		clock.advance_ms(300);
+		ct.tap(key, clock.now(), false);
+		REQUIRE(ct.samples(key) == n + 1);
+	}
+
+	SECTION("Section saved and loaded") {
+		ct.setAdaptive(cfg);
+		taps(ct, clock, 100, 150);
+		const std::string file = "/tmp/mimap_test_15.count";
+		REQUIRE(ct.save(file));
+		CountTimeout loaded(600);
+		loaded.setAdaptive(cfg);
+		REQUIRE(loaded.load(file));
+		REQUIRE(loaded.timeout(key) == ct.timeout(key));
+		REQUIRE(loaded.samples(key) == ct.samples(key));
+		REQUIRE(loaded.toString() == ct.toString());
+		std::remove(file.c_str());
+		REQUIRE_FALSE(loaded.load(file));
+	}
+
+	SECTION("Section edited file is kept within bounds") {
+		ct.setAdaptive(cfg);
+		const std::string file = "/tmp/mimap_test_15_bad.count";
+		{
+			std::ofstream f(file);
+			f << "0 61 0 1 2\n0 62 99999\n0 63 -5 3\n0 64 400\n";
+		}
+		REQUIRE(ct.load(file));
+		std::remove(file.c_str());
+		REQUIRE(ct.timeout(61) == cfg.min_ms);
+		REQUIRE(ct.timeout(62) == cfg.max_ms);
+		REQUIRE(ct.timeout(63) == cfg.min_ms);
+		REQUIRE(ct.timeout(64) == 400);
+	}
+
+	SECTION("Section bad settings") {
+		cfg.min_ms = 2000;
+		REQUIRE_THROWS(ct.setAdaptive(cfg));
+		REQUIRE_FALSE(ct.isAdaptive());
+	}
+}
+
+TEST_CASE("Test COUNT with learned timeout", "[all]") {
+	LoopbackTransport loopback;
+	VirtualClock clock;
+	RuleMapper mapper("", &loopback);
+	mapper.parseString("n,0,60,=c");
+	mapper.setClock(clock);
+	mapper.compile();
+	mapper.get_count_timeout().setAdaptive(CountTimeoutConfig());
+
+	auto tap = [&](int gap_ms) {
+		MidiEvent ev("n,0,60,100");
+		mapper.applyRules(ev);
+		clock.advance_ms(50);
+		mapper.get_count_timer().advance(clock.now());
+		ev = MidiEvent("n,0,60,0");
+		mapper.applyRules(ev);
+		clock.advance_ms(gap_ms);
+		mapper.get_count_timer().advance(clock.now());
+	};
+	auto output = [&]() {
+		std::vector<std::string> v;
+		snd_seq_event_t event;
+		MidiEvent ev;
+		while (loopback.take_output(event)) {
+			if (readMidiEvent(&event, ev))
+				v.push_back(ev.toString());
+		}
+		return v;
+	};
+
+	// slow double tap with default timeout
+	tap(250);
+	tap(1000);
+	REQUIRE(output() == std::vector<std::string> { "n,0,60,2" });
+	// player taps fast
+	for (int i = 0; i < 20; i++) {
+		tap(100);
+		tap(1000);
+	}
+	REQUIRE(output().size() == 20);
+	REQUIRE(mapper.get_count_timeout().timeout(60) == 210);
+	// the same slow double tap is two single taps first, the missed tap is
+	// learned and the window grows back
+	tap(250);
+	tap(1000);
+	REQUIRE(output() == std::vector<std::string> { "n,0,60,1", "n,0,60,1" });
+	REQUIRE(mapper.get_count_timeout().timeout(60) == 360);
+	for (int i = 0; i < 3; i++) {
+		tap(250);
+		tap(1000);
+		REQUIRE(output() == std::vector<std::string> { "n,0,60,2" });
+	}
+}
+
+TEST_CASE("Test COUNT max count is not a missed tap", "[all]") {
+	LoopbackTransport loopback;
+	VirtualClock clock;
+	RuleMapper mapper("", &loopback);
+	mapper.parseString("n,0,60,=c:m2");
+	mapper.setClock(clock);
+	mapper.compile();
+	mapper.get_count_timeout().setAdaptive(CountTimeoutConfig());
+
+	auto tap = [&](int gap_ms) {
+		MidiEvent ev("n,0,60,100");
+		mapper.applyRules(ev);
+		clock.advance_ms(50);
+		ev = MidiEvent("n,0,60,0");
+		mapper.applyRules(ev);
+		clock.advance_ms(gap_ms);
+		mapper.get_count_timer().advance(clock.now());
+	};
+	// fast double taps end by max count, next one comes slower but it is
+	// not a tap that missed the window
+	for (int i = 0; i < 40; i++) {
+		tap(50);
+		tap(250);
+	}
+	REQUIRE(mapper.get_count_timeout().samples(60) == 40);
+	REQUIRE(mapper.get_count_timeout().timeout(60) == CountTimeoutConfig().min_ms);
+}
@@ -0,0 +1,66 @@
+#include "pch.hpp"
+#include "RuleMapper.hpp"
+#include "LoopbackTransport.hpp"
+#include "lib/clock.hpp"
+#include "catch.hpp"
+
+namespace {
+// output events as "event@delay"
+std::vector<std::string> output(LoopbackTransport& loopback) {
+	std::vector<std::string> v;
+	snd_seq_event_t event;
+	MidiEvent ev;
+	while (loopback.take_output(event)) {
+		if (readMidiEvent(&event, ev))
+			v.push_back(ev.toString() + "@" + std::to_string(LoopbackTransport::delay_ms(event)));
+	}
+	return v;
+}
+}
+
+TEST_CASE("Test delayed output", "[all]") {
+	LoopbackTransport loopback;
+	VirtualClock clock;
+	RuleMapper mapper("", &loopback);
+	mapper.parseString("n,0,60,=c:d100");
+	mapper.parseString("c,0,1,=c,0,2,=s:d250");
+	mapper.parseString("c,0,3,=c,0,4,=s");
+	mapper.parseString("p,,,=p,,,=s");
+	mapper.parseString("c,0,5:9,=c,1,,=s:d1500");
+	mapper.setClock(clock);
+
+	REQUIRE(mapper.getRule(1).delayMs == 250);
+	REQUIRE(mapper.getRule(1).toString() == "c,0:0,1:1,0:127=c,0:0,2:2,0:127=s:d250");
+	REQUIRE_THROWS_AS(MidiEventRule("c,0,1,=c,0,2,=s:d0"), MidiAppError);
+	REQUIRE_THROWS_AS(MidiEventRule("c,0,1,=c,0,2,=s:d10001"), MidiAppError);
+	// delay of rules that pass event on would not take effect
+	REQUIRE_THROWS_AS(MidiEventRule("c,0,1,=c,0,2,=p:d100"), MidiAppError);
+	REQUIRE_THROWS_AS(MidiEventRule("c,0,1,=c,0,2,=o:d100"), MidiAppError);
+
+	for (const char* engine : { "scan", "index", "simd", "table" }) {
+		mapper.setEngine(RuleMapper::engineFromString(engine));
+		mapper.compile();
+		INFO(engine);
+		// delayed event is given to transport by rules, not by caller
+		MidiEvent ev("c,0,1,64");
+		REQUIRE_FALSE(mapper.applyRules(ev));
+		ev = MidiEvent("c,0,3,64");
+		REQUIRE(mapper.applyRules(ev));
+		REQUIRE(ev.toString() == "c,0,4,64");
+		ev = MidiEvent("c,0,7,64");
+		REQUIRE_FALSE(mapper.applyRules(ev));
+		ev = MidiEvent("p,0,7,0");
+		REQUIRE(mapper.applyRules(ev));
+		REQUIRE(output(loopback) == std::vector<std::string> { "c,0,2,64@250", "c,1,7,64@1500" });
+
+		// counted note goes out with delay of count rule
+		ev = MidiEvent("n,0,60,100");
+		REQUIRE(mapper.applyRules(ev));
+		ev = MidiEvent("n,0,60,0");
+		mapper.applyRules(ev);
+		clock.advance_ms(1000);
+		mapper.get_count_timer().advance(clock.now());
+		REQUIRE(output(loopback) == std::vector<std::string> { "n,0,60,1@100" });
+	}
+	REQUIRE(loopback.get_stats().delayed_events == 12);
+}
@@ -1,11 +1,12 @@
 #include "pch.hpp"
 #include "MidiEvent.hpp"
 #include "RuleMapper.hpp"
-#include "MidiClient.hpp"
+#include "LoopbackTransport.hpp"
+#include "MidiConverter.hpp"
 #include "catch.hpp"
 
 TEST_CASE("Test RuleMapper 1", "[all]") {
-	MidiClient c1("abc", nullptr, nullptr);
+	LoopbackTransport c1;
 	RuleMapper r1("", &c1);
 	r1.parseString("n,,0:20,10:127=n,2,22,22=  p ; note rule 1");
 	r1.parseString("n,,,=n,2,122,  =p; note rule 2");
@@ -28,7 +29,7 @@ TEST_CASE("Test RuleMapper 1", "[all]") {
 }
 
 TEST_CASE("Test RuleMapper 2", "[all]") {
-	MidiClient c1("abc", nullptr, nullptr);
+	LoopbackTransport c1;
 	RuleMapper r1("", &c1);
 	r1.parseString("n,,,=n,,,0=p");
 
@@ -43,3 +44,200 @@ TEST_CASE("Test RuleMapper 2", "[all]") {
 		REQUIRE(r1.findMatchingRule(e3, 0) == -1);
 	}
 }
+
+TEST_CASE("Test RuleMapper compiled table", "[all]") {
+	LoopbackTransport c1;
+	RuleMapper r1("", &c1);
+	r1.parseString("c,0,12:13,0:70=n,,,77=p");
+	r1.parseString("c,0,12:13,127:127=n,,,0=p");
+	r1.parseString("n,1:3,30:40,1:127=c,2,,=p");
+	r1.parseString("c,,,120:127=n,15,,20=s");
+	r1.parseString("p,,,=n,4,,=s");
+	r1.parseString("n,,,1:5=n,0,0,0=s");
+	r1.parseString("a,,,=a,,,=p");
+	REQUIRE(!r1.isCompiled());
+	r1.compile();
+	REQUIRE(r1.isCompiled());
+
+	SECTION("Section same result as interpreter") {
+		const char types[] = { 'n', 'c', 'p' };
+		int mismatch = 0;
+		for (char t : types) {
+			for (int ch = 0; ch < 16; ch++) {
+				for (int v1 = 0; v1 < 128; v1 += 3) {
+					for (int v2 = 0; v2 < 128; v2++) {
+						MidiEvent e1;
+						e1.evtype = static_cast<MidiEventType>(t);
+						e1.ch = ch;
+						e1.v1 = v1;
+						e1.v2 = v2;
+						MidiEvent e2 = e1;
+						bool b1 = r1.applyRules(e1);
+						bool b2 = r1.interpretRules(e2);
+						if (b1 != b2 || (b1 && !e1.isEqual(e2)))
+							mismatch++;
+					}
+				}
+			}
+		}
+		REQUIRE(mismatch == 0);
+	}
+
+	SECTION("Section stateful rules left to interpreter") {
+		r1.parseString("n,0,60,=c");
+		r1.compile();
+		MidiEvent e1("n,0,60,100"), e2("n,0,62,100"), e3("n,0,62,3");
+		REQUIRE(r1.isCompiled());
+		REQUIRE(!r1.applyRules(e2));
+		REQUIRE(r1.applyRules(e3));
+		REQUIRE(e3.toString() == "n,0,0,0");
+		REQUIRE(r1.findMatchingRule(e1, 0) == 6);
+		REQUIRE(r1.findMatchingRule(e1, 7) == 7);
+	}
+}
+
+TEST_CASE("Test RuleMapper rule index", "[all]") {
+	LoopbackTransport c1;
+	RuleMapper r1("", &c1), r2("", &c1);
+	const char* rules[] = { "c,0,12:13,0:70=n,,,77=p", "n,0,12:13,=n,,,=o",
+		"n,1:3,30:40,1:127=c,2,,=p", "a,4:5,,=n,,,=p", "c,,,120:127=n,15,,20=s",
+		"n,2,,=p,,,=o", "p,,,=n,4,,=p", "a,,,=a,,,=p" };
+	for (const char* s : rules) {
+		r1.parseString(s);
+		r2.parseString(s);
+	}
+	r2.compile();
+
+	SECTION("Section same matches as full scan") {
+		const char types[] = { 'n', 'c', 'p', 'a' };
+		int mismatch = 0;
+		unsigned int seed = 1;
+		for (int k = 0; k < 20000; k++) {
+			seed = seed * 1103515245 + 12345;
+			MidiEvent e1;
+			e1.evtype = static_cast<MidiEventType>(types[(seed >> 8) % 4]);
+			e1.ch = (seed >> 12) % 16;
+			e1.v1 = (seed >> 16) % 128;
+			e1.v2 = (seed >> 23) % 128;
+			MidiEvent e2 = e1;
+			if (r1.findMatchingRule(e1, k % 4) != r2.findMatchingRule(e2, k % 4))
+				mismatch++;
+			bool b1 = r1.interpretRules(e1);
+			bool b2 = r2.interpretRules(e2);
+			if (b1 != b2 || !e1.isEqual(e2))
+				mismatch++;
+		}
+		REQUIRE(mismatch == 0);
+	}
+}
+
+TEST_CASE("Test RuleMapper SIMD matcher", "[all]") {
+	LoopbackTransport c1;
+	RuleMapper r1("", &c1, RuleEngine::SCAN), r2("", &c1, RuleEngine::SIMD);
+	const char types[] = { 'n', 'c', 'p', 'a' };
+	unsigned int seed = 7;
+	auto next = [&seed](int n) {
+		seed = seed * 1103515245 + 12345;
+		return static_cast<int>((seed >> 16) % n);
+	};
+	// number of rules is not multiple of SIMD block size
+	for (int k = 0; k < 77; k++) {
+		int ch = next(16), v1 = next(128), v2 = next(128);
+		std::ostringstream ss;
+		ss << types[next(4)] << "," << ch << ":" << ch + next(16 - ch) << ","
+			<< v1 << ":" << v1 + next(128 - v1) << "," << v2 << ":" << v2 + next(128 - v2)
+			<< "=" << types[next(4)] << ",,," << next(128) << "=" << (k % 9 ? "p" : "s");
+		r1.parseString(ss.str());
+		r2.parseString(ss.str());
+	}
+	r1.compile();
+	r2.compile();
+
+	SECTION("Section same matches as full scan") {
+		int mismatch = 0;
+		for (int k = 0; k < 20000; k++) {
+			MidiEvent e1;
+			e1.evtype = static_cast<MidiEventType>(types[next(4)]);
+			e1.ch = next(16);
+			e1.v1 = next(128);
+			e1.v2 = next(128);
+			MidiEvent e2 = e1;
+			int start = next(80);
+			if (r1.findMatchingRule(e1, start) != r2.findMatchingRule(e2, start))
+				mismatch++;
+			if (r1.applyRules(e1) != r2.applyRules(e2) || !e1.isEqual(e2))
+				mismatch++;
+		}
+		REQUIRE(mismatch == 0);
+		REQUIRE(r2.findMatchingRule(MidiEvent("n,1,1,1"), 77) == -1);
+	}
+}
+
+TEST_CASE("Test transport batch counters", "[all]") {
+	MidiClientStats st;
+	REQUIRE(st.avg_batch() == 0);
+	st.input_batches = 4;
+	st.input_events = 10;
+	st.queued_events = 9;
+	st.output_flushes = 3;
+	REQUIRE(st.avg_batch() == 2.5);
+	REQUIRE(st.syscalls_saved() == 6 + 6);
+
+	LoopbackTransport c1;
+	snd_seq_event_t event;
+	snd_seq_ev_clear(&event);
+	c1.queue_event(&event);
+	c1.queue_event(&event);
+	c1.flush_output();
+	c1.flush_output();
+	REQUIRE(c1.get_stats().queued_events == 2);
+	REQUIRE(c1.get_stats().output_flushes == 1);
+}
+
+TEST_CASE("Test converter with loopback transport", "[all]") {
+	LoopbackTransport c1(64);
+	RuleMapper r1("", &c1);
+	r1.parseString("n,,,1:5=n,0,0,0=s");
+	r1.parseString("c,,,=n,2,,=p");
+	r1.parseString("n,,,=n,,,=p");
+	r1.compile();
+	MidiConverter conv(&r1);
+	c1.set_nonblock(true);
+	MidiEvent ev;
+	REQUIRE(conv.process_batch(ev) == 0);
+
+	const char* input[] = { "n,3,60,100", "c,1,7,50", "n,4,61,3" };
+	for (const char* s : input) {
+		snd_seq_event_t event;
+		snd_seq_ev_clear(&event);
+		REQUIRE(writeMidiEvent(&event, MidiEvent(s)));
+		REQUIRE(c1.inject(event));
+	}
+	std::vector<pollfd> fds = c1.get_poll_fds();
+	REQUIRE(fds.size() == 1);
+	REQUIRE(poll(fds.data(), 1, 0) == 1);
+	REQUIRE(conv.process_batch(ev) == 3);
+	REQUIRE(poll(fds.data(), 1, 0) == 0);
+	REQUIRE(c1.get_stats().input_batches == 1);
+	REQUIRE(c1.get_stats().output_flushes == 1);
+
+	const char* output[] = { "n,3,60,100", "n,2,7,50", "n,0,0,0" };
+	for (const char* s : output) {
+		snd_seq_event_t event;
+		REQUIRE(c1.take_output(event));
+		REQUIRE(readMidiEvent(&event, ev));
+		REQUIRE(ev.toString() == s);
+	}
+	snd_seq_event_t event;
+	REQUIRE(!c1.take_output(event));
+	REQUIRE(conv.get_latency().note.count() == 2);
+	REQUIRE(conv.get_latency().cc.count() == 1);
+
+	// time stamp after now gives latency 0, not a huge unsigned value
+	snd_seq_ev_clear(&event);
+	REQUIRE(writeMidiEvent(&event, MidiEvent("n,3,60,100")));
+	REQUIRE(c1.inject(event, std::chrono::steady_clock::now() + std::chrono::hours(1)));
+	REQUIRE(conv.process_batch(ev) == 1);
+	REQUIRE(conv.get_latency().note.count() == 3);
+	REQUIRE(conv.get_latency().note.max() < 1000000000ull);
+}
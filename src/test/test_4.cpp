@@ -1,6 +1,10 @@
 #include "pch.hpp"
 #include "MidiEvent.hpp"
 #include "lib/utils.hpp"
+#include "RuleSet.hpp"
+#include <cstdio>
+#include <cstring>
+#include <new>
 #include "catch.hpp"
 
 TEST_CASE("Test MidiEventRange", "[all][basic]") {
@@ -25,6 +29,24 @@ TEST_CASE("Test MidiEventRule 1", "[all][basic]") {
 		REQUIRE_THROWS_AS(MidiEventRule("n,5,,=c,,,=n"), MidiAppError);
 		REQUIRE_THROWS_AS(MidiEventRule("n,5,,1:127=c,,,=n"), MidiAppError);
 
+		MidiEventRule r3("n,5,,=c : m 3 ; count up to 3");
+		REQUIRE(r3.maxCount == 3);
+		REQUIRE(r3.toString() == "n,5:5,0:127,0:127=c:m3");
+		REQUIRE(MidiEventRule(r3.toString()).maxCount == 3);
+		REQUIRE_THROWS_AS(MidiEventRule("n,5,,=c:m0"), MidiAppError);
+		REQUIRE_THROWS_AS(MidiEventRule("n,5,,=c:m"), MidiAppError);
+		REQUIRE_THROWS_AS(MidiEventRule("n,5,,=c:x3"), MidiAppError);
+		REQUIRE_THROWS_AS(MidiEventRule("n,5,,=n,,,=s:m3"), MidiAppError);
+
+		MidiEventRule r4("n,5,,=c:h400:m2");
+		REQUIRE(r4.holdMs == 400);
+		REQUIRE(r4.toString() == "n,5:5,0:127,0:127=c:m2:h400");
+		REQUIRE(MidiEventRule(r4.toString()).holdMs == 400);
+		REQUIRE(r3.holdMs == 0);
+		REQUIRE_THROWS_AS(MidiEventRule("n,5,,=c:h0"), MidiAppError);
+		REQUIRE_THROWS_AS(MidiEventRule("n,5,,=c:h20000"), MidiAppError);
+		REQUIRE_THROWS_AS(MidiEventRule("n,5,,=n,,,=s:h400"), MidiAppError);
+
 	}
 }
 
@@ -34,7 +56,62 @@ TEST_CASE("Test MidiEventRule 2", "[all][basic]") {
 		MidiEventRule rule("n,5,,=n,2,3,5=p; comment ");
 		MidiEvent e1("n,5,22,33"), e2("n,6,33,22");
 
-		REQUIRE(rule.inEventRange->match(e1));
-		REQUIRE(!rule.inEventRange->match(e2));
+		REQUIRE(rule.inEventRange.match(e1));
+		REQUIRE(!rule.inEventRange.match(e2));
+	}
+	SECTION("Section rule bytes") {
+		// rule cache writes rules as raw bytes, same rule must give same bytes
+		alignas(MidiEventRule) unsigned char b1[sizeof(MidiEventRule)], b2[sizeof(MidiEventRule)];
+		memset(b1, 0x00, sizeof(b1));
+		memset(b2, 0xff, sizeof(b2));
+		new (b1) MidiEventRule("n,5,,=c:m3:h400");
+		new (b2) MidiEventRule("n,5,,=c:m3:h400");
+		REQUIRE(memcmp(b1, b2, sizeof(b1)) == 0);
+		memset(b2, 0xff, sizeof(b2));
+		new (b1) MidiEventRule();
+		new (b2) MidiEventRule();
+		REQUIRE(memcmp(b1, b2, sizeof(b1)) == 0);
+	}
+}
+
+TEST_CASE("Test rule lexer", "[all][basic]") {
+	SECTION("Section text span") {
+		std::string s(" n , 5 ,, 1 : 20 ; comment, with = parts");
+		TextSpan t(s);
+		TextSpan parts[4];
+		REQUIRE(t.code().split(',', parts, 4) == 4);
+		REQUIRE(parts[0].first() == 'n');
+		REQUIRE(parts[0].count() == 1);
+		REQUIRE(parts[2].blank());
+		int v;
+		REQUIRE(parts[1].toInt(v));
+		REQUIRE(v == 5);
+		REQUIRE(!parts[3].toInt(v));
+		REQUIRE(t.code().compact() == "n,5,,1:20");
+		REQUIRE(t.split(',', parts, 2) == 5);
+	}
+
+	SECTION("Section rule file") {
+		const std::string file = "/tmp/mimap_test_lexer.rules";
+		{
+			std::ofstream f(file);
+			f << "; comment line\r\n"
+				"n,0,60,=n,,,100=s\r\n"
+				"\r\n"
+				"  c , 1 , 7 , 0:10 = c , , 8 , = p ; with comment\r\n"
+				"n,0,300,=n,,,100=s\r\n"
+				"n,0,61=s\n"
+				"a,,,=p";
+		}
+		RuleSet rs(RuleEngine::SCAN);
+		REQUIRE(rs.readFile(file) == 2);
+		REQUIRE(rs.rules.size() == 3);
+		REQUIRE(rs.rules[0].toString() == "n,0:0,60:60,0:127=n,0:15,0:127,100:100=s");
+		REQUIRE(rs.rules[1].toString() == "c,1:1,7:7,0:10=c,0:15,8:8,0:127=p");
+		REQUIRE(rs.rules[2].toString() == "a,0:15,0:127,0:127=p");
+		MidiEvent ev("n,3,4,5");
+		rs.rules[2].outEventRange.transform(ev);
+		REQUIRE(ev.toString() == "n,3,4,5");
+		std::remove(file.c_str());
 	}
 }
@@ -0,0 +1,51 @@
+#include "pch.hpp"
+#include "MidiEvent.hpp"
+#include "RuleMapper.hpp"
+#include "catch.hpp"
+#include <chrono>
+
+// Hidden test, run as: ./app_t "[bench]"
+TEST_CASE("Benchmark rule matching scan vs SIMD", "[.][bench]") {
+	LogLvl old_level = LOG::ReportingLevel();
+	LOG::ReportingLevel() = LogLvl::ERROR;
+	const int sizes[] = { 10, 100, 1000, 10000 };
+	const int n_events = 100000;
+
+	for (int n_rules : sizes) {
+		RuleMapper scan("", nullptr, RuleEngine::SCAN), simd("", nullptr, RuleEngine::SIMD);
+		// per note mappings, each event matches one rule near random position
+		for (int k = 0; k < n_rules; k++) {
+			std::ostringstream ss;
+			ss << "n," << (k / 128) % 16 << "," << k % 128 << ",=c,,,=s";
+			scan.parseString(ss.str());
+			simd.parseString(ss.str());
+		}
+		scan.compile();
+		simd.compile();
+
+		std::vector<MidiEvent> events(n_events);
+		unsigned int seed = 1;
+		for (MidiEvent& ev : events) {
+			seed = seed * 1103515245 + 12345;
+			ev.evtype = MidiEventType::NOTE;
+			ev.ch = (seed >> 8) % 16;
+			ev.v1 = (seed >> 16) % 128;
+			ev.v2 = 100;
+		}
+
+		long sum[2] = { 0, 0 };
+		double ns[2];
+		RuleMapper* mappers[2] = { &scan, &simd };
+		for (int m = 0; m < 2; m++) {
+			auto start = std::chrono::steady_clock::now();
+			for (const MidiEvent& ev : events)
+				sum[m] += mappers[m]->findMatchingRule(ev, 0);
+			ns[m] = std::chrono::duration<double, std::nano>(
+				std::chrono::steady_clock::now() - start).count() / n_events;
+		}
+		REQUIRE(sum[0] == sum[1]);
+		cout << "rules: " << n_rules << "\tscan ns/event: " << ns[0] << "\t"
+			<< RuleMatcher::instructionSet() << " ns/event: " << ns[1] << std::endl;
+	}
+	LOG::ReportingLevel() = old_level;
+}
@@ -0,0 +1,87 @@
+#include "pch.hpp"
+#include "lib/timer_wheel.hpp"
+#include "lib/clock.hpp"
+#include "catch.hpp"
+#include <atomic>
+
+TEST_CASE("Test TimerWheel 1", "[all]") {
+	std::mutex mtx;
+	std::vector<std::pair<int, uint64_t>> fired;
+	TimerWheel wheel(16, [&](int key, uint64_t arg) {
+		std::lock_guard<std::mutex> lock(mtx);
+		fired.push_back(std::make_pair(key, arg));
+		});
+
+	SECTION("Section fire, re-arm and cancel") {
+		wheel.schedule(1, 30, 100);
+		wheel.schedule(2, 20, 200);
+		wheel.schedule(3, 20, 300);
+		wheel.schedule(1, 60, 101); // re-arm replaces first timer
+		wheel.cancel(3);
+		REQUIRE(wheel.armedCount() == 2);
+		REQUIRE(wheel.isArmed(1));
+		REQUIRE(!wheel.isArmed(3));
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		std::lock_guard<std::mutex> lock(mtx);
+		REQUIRE(fired.size() == 2);
+		REQUIRE(fired[0] == std::make_pair(2, static_cast<uint64_t>(200)));
+		REQUIRE(fired[1] == std::make_pair(1, static_cast<uint64_t>(101)));
+		REQUIRE(wheel.armedCount() == 0);
+	}
+
+	SECTION("Section timer longer than one turn of the wheel") {
+		wheel.schedule(5, 1500, 5);
+		REQUIRE(wheel.advance(TimerWheel::clock_t::now() + std::chrono::milliseconds(1000)) == 0);
+		REQUIRE(wheel.isArmed(5));
+		REQUIRE(wheel.advance(TimerWheel::clock_t::now() + std::chrono::milliseconds(1600)) == 1);
+		REQUIRE(!wheel.isArmed(5));
+	}
+}
+
+TEST_CASE("Test TimerWheel 2", "[all]") {
+	int fired = 0;
+	TimerWheel wheel(4, [&fired](int, uint64_t) { fired++; });
+	wheel.setThreaded(false);
+
+	SECTION("Section wheel driven by event loop") {
+		TimerWheel::clock_t::time_point t;
+		REQUIRE(!wheel.nextDeadline(t));
+		wheel.schedule(0, 50, 0);
+		REQUIRE(wheel.nextDeadline(t));
+		REQUIRE(t > TimerWheel::clock_t::now());
+		REQUIRE(wheel.advance(t - std::chrono::milliseconds(20)) == 0);
+		REQUIRE(wheel.advance(t) == 1);
+		REQUIRE(fired == 1);
+		REQUIRE(!wheel.nextDeadline(t));
+	}
+}
+
+TEST_CASE("Test TimerWheel 3", "[all]") {
+	// handler arms and cancels timers of the unlocked wheel while it advances
+	std::vector<int> keys;
+	TimerWheel* w = nullptr;
+	TimerWheel wheel(4, [&keys, &w](int key, uint64_t arg) {
+		keys.push_back(key);
+		if (arg > 0)
+			w->schedule(key, 10, arg - 1);
+		w->cancel(3);
+	});
+	w = &wheel;
+	VirtualClock clock;
+	wheel.setClock(clock);
+
+	SECTION("Section handler uses wheel") {
+		wheel.schedule(0, 10, 1);
+		wheel.schedule(3, 200, 0);
+		REQUIRE(wheel.armedCount() == 2);
+		clock.advance_ms(50);
+		REQUIRE(wheel.advance(clock.now()) == 1);
+		REQUIRE(wheel.isArmed(0));
+		REQUIRE(!wheel.isArmed(3));
+		clock.advance_ms(50);
+		REQUIRE(wheel.advance(clock.now()) == 1);
+		REQUIRE(wheel.armedCount() == 0);
+		REQUIRE(keys == std::vector<int>({ 0, 0 }));
+	}
+}
@@ -0,0 +1,57 @@
+#include "pch.hpp"
+#include "lib/spsc_ring.hpp"
+#include "catch.hpp"
+
+TEST_CASE("Test SpscRing 1", "[all][basic]") {
+
+	SECTION("Section push and pop") {
+		SpscRing<int> ring(4);
+		int v = 0;
+		REQUIRE(ring.empty());
+		REQUIRE(!ring.pop(v));
+		for (int i = 0; i < 4; i++)
+			REQUIRE(ring.push(i));
+		REQUIRE(!ring.push(4));
+		REQUIRE(ring.size() == 4);
+		REQUIRE(ring.max_size() == 4);
+		REQUIRE(ring.pop(v));
+		REQUIRE(v == 0);
+		REQUIRE(ring.push(4));
+		for (int i = 1; i <= 4; i++) {
+			REQUIRE(ring.pop(v));
+			REQUIRE(v == i);
+		}
+		REQUIRE(ring.empty());
+	}
+
+	SECTION("Section capacity") {
+		REQUIRE_THROWS_AS(SpscRing<int>(3), std::invalid_argument);
+		REQUIRE_THROWS_AS(SpscRing<int>(0), std::invalid_argument);
+		REQUIRE(SpscRing<int>(8).capacity() == 8);
+	}
+}
+
+TEST_CASE("Test SpscRing 2", "[all]") {
+
+	SECTION("Section two threads keep order") {
+		SpscRing<int> ring(64);
+		const int count = 200000;
+		std::thread producer([&ring]() {
+			for (int i = 0; i < count; i++) {
+				while (!ring.push(i))
+					std::this_thread::yield();
+			}
+			});
+		int expected = 0, v;
+		bool in_order = true;
+		while (expected < count) {
+			if (!ring.pop(v))
+				continue;
+			in_order = in_order && v == expected;
+			expected++;
+		}
+		producer.join();
+		REQUIRE(in_order);
+		REQUIRE(ring.empty());
+	}
+}
@@ -0,0 +1,32 @@
+#include "pch.hpp"
+#include "lib/histogram.hpp"
+#include "catch.hpp"
+
+TEST_CASE("Test LatencyHistogram 1", "[all][basic]") {
+	// bucket of a value covers it and is narrow
+	for (uint64_t v : { 0ull, 1ull, 7ull, 8ull, 9ull, 100ull, 1000ull, 123456ull, 987654321ull }) {
+		int i = LatencyHistogram::bucketIndex(v);
+		REQUIRE(LatencyHistogram::bucketUpper(i) >= v);
+		if (i > 0)
+			REQUIRE(LatencyHistogram::bucketUpper(i - 1) < v);
+		REQUIRE(LatencyHistogram::bucketUpper(i) - v <= v / 8);
+	}
+	REQUIRE(LatencyHistogram::bucketIndex(~0ull) == LatencyHistogram::bucket_count - 1);
+}
+
+TEST_CASE("Test LatencyHistogram 2", "[all][basic]") {
+	LatencyHistogram h;
+	REQUIRE(h.count() == 0);
+	REQUIRE(h.percentile(50) == 0);
+	for (uint64_t v = 1; v <= 1000; v++)
+		h.record(v * 1000);
+	REQUIRE(h.count() == 1000);
+	REQUIRE(h.max() == 1000000);
+	REQUIRE(h.percentile(50) >= 500000);
+	REQUIRE(h.percentile(50) <= 500000 * 9 / 8);
+	REQUIRE(h.percentile(99) >= 990000);
+	REQUIRE(h.percentile(100) == 1000000);
+	h.reset();
+	REQUIRE(h.count() == 0);
+	REQUIRE(h.max() == 0);
+}
@@ -0,0 +1,219 @@
+#include "pch.hpp"
+#include "RuleMapper.hpp"
+#include "LoopbackTransport.hpp"
+#include "MidiConverter.hpp"
+#include "lib/clock.hpp"
+#include "catch.hpp"
+
+namespace {
+// replays note events on virtual time, counted notes come out of loopback
+struct TapReplay {
+	LoopbackTransport loopback;
+	VirtualClock clock;
+	RuleMapper mapper { "", &loopback };
+	int sent = 0; // events sent by rules at once
+
+	TapReplay() {
+		mapper.parseString("n,0,60,=c");
+		mapper.parseString("n,0,62,=c");
+		mapper.parseString("n,0,64,=c:m3");
+		mapper.parseString("n,0,65,=c:h300");
+		mapper.setClock(clock);
+		mapper.compile();
+	}
+	void note(int note, int velocity) {
+		MidiEvent ev;
+		ev.evtype = MidiEventType::NOTE;
+		ev.v1 = note;
+		ev.v2 = velocity;
+		sent += mapper.applyRules(ev);
+	}
+	void wait(int ms) {
+		clock.advance_ms(ms);
+		mapper.get_count_timer().advance(clock.now());
+	}
+	void tap(int n, int hold_ms, int gap_ms) {
+		note(n, 100);
+		wait(hold_ms);
+		note(n, 0);
+		wait(gap_ms);
+	}
+	std::vector<std::string> output() {
+		std::vector<std::string> v;
+		snd_seq_event_t event;
+		MidiEvent ev;
+		loopback.flush_output();
+		while (loopback.take_output(event)) {
+			if (readMidiEvent(&event, ev))
+				v.push_back(ev.toString());
+		}
+		return v;
+	}
+};
+}
+
+TEST_CASE("Test COUNT with virtual clock", "[all]") {
+	TapReplay r;
+
+	SECTION("Section single, double and double with hold") {
+		r.tap(60, 100, 1000);
+		REQUIRE(r.output() == std::vector<std::string> { "n,0,60,1" });
+		r.tap(60, 100, 200);
+		r.tap(60, 100, 1000);
+		REQUIRE(r.output() == std::vector<std::string> { "n,0,60,2" });
+		r.tap(60, 100, 200);
+		r.tap(60, 1000, 1000);
+		REQUIRE(r.output() == std::vector<std::string> { "n,0,60,7" });
+		REQUIRE(r.sent == 3); // first note ON of each series
+	}
+
+	SECTION("Section series ends at max count") {
+		r.tap(64, 100, 100);
+		r.tap(64, 100, 100);
+		r.note(64, 100);
+		// third tap is sent on note ON, no wait for timeout
+		REQUIRE(r.output() == std::vector<std::string> { "n,0,64,3" });
+		REQUIRE(r.mapper.get_count_timer().armedCount() == 0);
+		r.wait(1000);
+		r.note(64, 0);
+		r.wait(1000);
+		REQUIRE(r.output().empty());
+		// shorter series wait for timeout as before
+		r.tap(64, 100, 200);
+		r.tap(64, 1000, 1000);
+		REQUIRE(r.output() == std::vector<std::string> { "n,0,64,7" });
+	}
+
+	SECTION("Section hold is sent at hold time") {
+		r.tap(65, 100, 100);
+		r.note(65, 100);
+		r.wait(290);
+		REQUIRE(r.output().empty());
+		// double tap and hold is sent while note is still held
+		r.wait(20);
+		REQUIRE(r.output() == std::vector<std::string> { "n,0,65,7" });
+		REQUIRE(r.mapper.get_count_timer().armedCount() == 1);
+		r.wait(2000);
+		r.note(65, 0);
+		r.wait(1000);
+		REQUIRE(r.output().empty());
+		REQUIRE(r.mapper.get_count_timer().armedCount() == 0);
+		// released notes end series on timeout
+		r.tap(65, 100, 100);
+		r.tap(65, 250, 1000);
+		REQUIRE(r.output() == std::vector<std::string> { "n,0,65,2" });
+		r.tap(65, 350, 1000);
+		REQUIRE(r.output() == std::vector<std::string> { "n,0,65,6" });
+		REQUIRE(r.sent == 3);
+	}
+
+	SECTION("Section other note is counted at the same time") {
+		r.tap(60, 100, 200);
+		r.tap(62, 100, 1000);
+		REQUIRE(r.output() == std::vector<std::string> { "n,0,60,1", "n,0,62,1" });
+		REQUIRE(r.mapper.get_count_timer().armedCount() == 0);
+		// overlapping gestures: double tap of 60 and hold of 62
+		r.note(60, 100);
+		r.wait(50);
+		r.note(62, 100);
+		r.wait(50);
+		r.note(60, 0);
+		r.wait(100);
+		r.note(60, 100);
+		r.wait(100);
+		r.note(60, 0);
+		r.wait(1000);
+		r.note(62, 0);
+		r.wait(1000);
+		REQUIRE(r.output() == std::vector<std::string> { "n,0,62,6", "n,0,60,2" });
+		REQUIRE(r.sent == 4);
+	}
+
+	SECTION("Section many random tap sequences") {
+		LogLvl old_level = LOG::ReportingLevel();
+		LOG::ReportingLevel() = LogLvl::ERROR;
+		unsigned int seed = 7;
+		int mismatch = 0;
+		for (int k = 0; k < 5000; k++) {
+			seed = seed * 1103515245 + 12345;
+			int taps = 1 + (seed >> 8) % 4;
+			bool hold = (seed >> 12) % 2;
+			for (int i = 0; i < taps; i++) {
+				seed = seed * 1103515245 + 12345;
+				int hold_ms = 30 + (seed >> 8) % 200;
+				int gap_ms = 30 + (seed >> 16) % 300;
+				if (i + 1 == taps)
+					r.tap(60, hold ? 800 + hold_ms : hold_ms, 1000);
+				else
+					r.tap(60, hold_ms, gap_ms);
+			}
+			std::vector<std::string> out = r.output();
+			std::string expected = "n,0,60," + std::to_string(taps + (hold ? 5 : 0));
+			if (out.size() != 1 || out[0] != expected)
+				mismatch++;
+		}
+		LOG::ReportingLevel() = old_level;
+		REQUIRE(mismatch == 0);
+		REQUIRE(r.sent == 5000);
+	}
+}
+
+TEST_CASE("Test COUNT max count with timer thread", "[all]") {
+	LoopbackTransport loopback;
+	RuleMapper mapper("", &loopback);
+	mapper.parseString("n,0,0:59,=c");
+	mapper.parseString("n,0,64,=c:m2");
+	mapper.compile();
+	MidiConverter converter(&mapper);
+	loopback.set_nonblock(true);
+
+	int singles = 0, doubles = 0, other = 0;
+	auto take = [&]() {
+		snd_seq_event_t event;
+		MidiEvent ev;
+		while (loopback.take_output(event)) {
+			if (!readMidiEvent(&event, ev) || ev.v2 == 100)
+				continue; // first note ON of series
+			if (ev.v1 < 60 && ev.v2 == 1)
+				singles++;
+			else if (ev.v1 == 64 && ev.v2 == 2)
+				doubles++;
+			else
+				other++;
+		}
+	};
+	auto inject = [&](int note, int velocity) {
+		snd_seq_event_t event;
+		snd_seq_ev_clear(&event);
+		MidiEvent ev;
+		ev.evtype = MidiEventType::NOTE;
+		ev.v1 = note;
+		ev.v2 = velocity;
+		writeMidiEvent(&event, ev);
+		loopback.inject(event);
+	};
+
+	// single taps end on timer thread while double taps of note 64 are
+	// completed by event processing at the same time
+	MidiEvent ev;
+	const int series = 60;
+	for (int k = 0; k < series; k++) {
+		inject(k, 100);
+		inject(k, 0);
+		for (int i = 0; i < 2; i++) {
+			inject(64, 100);
+			inject(64, 0);
+		}
+		while (converter.process_batch(ev) > 0) {
+		}
+		take();
+		std::this_thread::sleep_for(std::chrono::milliseconds(25));
+	}
+	for (int i = 0; i < 300 && mapper.get_count_timer().armedCount() > 0; i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	take();
+	REQUIRE(singles == series);
+	REQUIRE(doubles == series);
+	REQUIRE(other == 0);
+	REQUIRE(loopback.get_stats().direct_events == static_cast<unsigned long>(series));
+}
@@ -0,0 +1,28 @@
+#include "pch.hpp"
+#include "RuleSet.hpp"
+#include "RuleCache.hpp"
+#include "RuleCodegen.hpp"
+#include "lib/utils.hpp"
+
+// Writes C++ code of rules in the file to standard output.
+// Usage: rulegen rules.txt > rules.cpp
+int main(int argc, char* argv[]) {
+	if (argc != 2) {
+		std::cerr << "Usage: rulegen <ruleFile> > <file.cpp>" << std::endl;
+		return 2;
+	}
+	LOG::ReportingLevel() = LogLvl::WARN;
+	const std::string fileName = argv[1];
+	std::string text;
+	if (!read_file(fileName, text)) {
+		std::cerr << "Cannot read rule file: " << fileName << std::endl;
+		return 1;
+	}
+	RuleSet rs(RuleEngine::SCAN);
+	if (rs.parseText(text, fileName) > 0) {
+		std::cerr << "Rule file has errors: " << fileName << std::endl;
+		return 1;
+	}
+	cout << generate_rule_code(rs.rules, fileName, rule_text_hash(text));
+	return 0;
+}